@@ -0,0 +1,251 @@
+#pragma once
+
+#include "CommonDefinitions.h"
+#include "Utility.h"
+
+// Restores heap property of the subtree rooted at given item. Items past count are not considered.
+template <typename T, typename Less> void SiftDown(T* items, size_t root, size_t count, Less less)
+{
+	for (;;)
+	{
+		size_t child = 2 * root + 1;
+		if (child >= count)
+			break;
+
+		if ((child + 1 < count) && less(items[child], items[child + 1]))
+			child++;
+
+		if (!less(items[root], items[child]))
+			break;
+
+		Swap(items[root], items[child]);
+		root = child;
+	}
+}
+
+// In-place sort in O(n log n) time for any input. Needs neither recursion nor additional memory,
+// so it suits kernel stacks and cannot fail. Equal items may be reordered.
+template <typename T, typename Less> void HeapSort(T* items, size_t count, Less less)
+{
+	if (count < 2)
+		return;
+
+	for (size_t i = count / 2; i > 0; i--)
+		SiftDown(items, i - 1, count, less);
+
+	for (size_t last = count - 1; last > 0; last--)
+	{
+		Swap(items[0], items[last]);
+		SiftDown(items, 0, last, less);
+	}
+}
+
+// Tells whether items are in non-descending order, which takes a single pass.
+template <typename T, typename Less> bool IsSorted(const T* items, size_t count, Less less)
+{
+	for (size_t i = 1; i < count; i++)
+	{
+		if (less(items[i], items[i - 1]))
+			return false;
+	}
+
+	return true;
+}
+
+// Set algebra over two ranges sorted by the same ordering with unique items in each, such as iterators of KSet,
+// KFlatSet or sorted KVector. Ranges are walked in lockstep, so every algorithm takes O(n + m) comparisons
+// rather than a lookup per item. Items of the result are passed to the output functor in ascending order,
+// so it may append them to a KVector through KPushBackSink and the vector may feed BuildFromSorted()
+// of KSet or Freeze() of KFlatSet. Equal items are taken from the first range. Iterators of locked containers
+// take the lock per step, thus a range changing meanwhile yields a result mixing both states.
+
+// Output functor appending items to a container with PushBack(), e.g. KVector.
+// Remembers whether some item could not be appended.
+template <typename Container> class KPushBackSink
+{
+	CLASS_NO_COPY(KPushBackSink)
+public:
+	explicit KPushBackSink(Container& container)
+		: m_container(container)
+		, m_failed(false)
+	{
+	}
+
+	template <typename T> void operator()(const T& val)
+	{
+		typename Container::Size_t size = m_container.GetSize();
+		m_container.PushBack(val);
+
+		if (m_container.GetSize() != size + 1)
+			m_failed = true;
+	}
+
+	bool IsFailed() const
+	{
+		return m_failed;
+	}
+
+private:
+	Container& m_container;
+	bool m_failed;
+};
+
+// Items present in either range.
+template <typename Iter1, typename Iter2, typename Out, typename Less>
+void Union(Iter1 first1, Iter1 last1, Iter2 first2, Iter2 last2, Out& out, Less less)
+{
+	while ((first1 != last1) && (first2 != last2))
+	{
+		if (less(*first1, *first2))
+		{
+			out(*first1);
+			++first1;
+		}
+		else if (less(*first2, *first1))
+		{
+			out(*first2);
+			++first2;
+		}
+		else
+		{
+			out(*first1);
+			++first1;
+			++first2;
+		}
+	}
+
+	for (; first1 != last1; ++first1)
+		out(*first1);
+
+	for (; first2 != last2; ++first2)
+		out(*first2);
+}
+
+// Items present in both ranges.
+template <typename Iter1, typename Iter2, typename Out, typename Less>
+void Intersection(Iter1 first1, Iter1 last1, Iter2 first2, Iter2 last2, Out& out, Less less)
+{
+	while ((first1 != last1) && (first2 != last2))
+	{
+		if (less(*first1, *first2))
+		{
+			++first1;
+		}
+		else if (less(*first2, *first1))
+		{
+			++first2;
+		}
+		else
+		{
+			out(*first1);
+			++first1;
+			++first2;
+		}
+	}
+}
+
+// Items of the first range absent from the second one.
+template <typename Iter1, typename Iter2, typename Out, typename Less>
+void Difference(Iter1 first1, Iter1 last1, Iter2 first2, Iter2 last2, Out& out, Less less)
+{
+	while ((first1 != last1) && (first2 != last2))
+	{
+		if (less(*first1, *first2))
+		{
+			out(*first1);
+			++first1;
+		}
+		else if (less(*first2, *first1))
+		{
+			++first2;
+		}
+		else
+		{
+			++first1;
+			++first2;
+		}
+	}
+
+	for (; first1 != last1; ++first1)
+		out(*first1);
+}
+
+// Items present in exactly one of the ranges.
+template <typename Iter1, typename Iter2, typename Out, typename Less>
+void SymmetricDifference(Iter1 first1, Iter1 last1, Iter2 first2, Iter2 last2, Out& out, Less less)
+{
+	while ((first1 != last1) && (first2 != last2))
+	{
+		if (less(*first1, *first2))
+		{
+			out(*first1);
+			++first1;
+		}
+		else if (less(*first2, *first1))
+		{
+			out(*first2);
+			++first2;
+		}
+		else
+		{
+			++first1;
+			++first2;
+		}
+	}
+
+	for (; first1 != last1; ++first1)
+		out(*first1);
+
+	for (; first2 != last2; ++first2)
+		out(*first2);
+}
+
+// Tells whether every item of the second range is present in the first one. Stops at the first item missing.
+template <typename Iter1, typename Iter2, typename Less>
+bool Includes(Iter1 first1, Iter1 last1, Iter2 first2, Iter2 last2, Less less)
+{
+	while (first2 != last2)
+	{
+		if ((first1 == last1) || less(*first2, *first1))
+			return false;
+
+		if (!less(*first1, *first2))
+			++first2;
+
+		++first1;
+	}
+
+	return true;
+}
+
+// Streams the symmetric difference to the functor as func(item, inFirst), where the flag tells which range
+// holds the item. Comparing old and new configurations, items only in the first one are removed and items
+// only in the second one are added. Nothing is stored, so it cannot fail.
+template <typename Iter1, typename Iter2, typename Func, typename Less>
+void ForEachDifference(Iter1 first1, Iter1 last1, Iter2 first2, Iter2 last2, Func& func, Less less)
+{
+	while ((first1 != last1) && (first2 != last2))
+	{
+		if (less(*first1, *first2))
+		{
+			func(*first1, true);
+			++first1;
+		}
+		else if (less(*first2, *first1))
+		{
+			func(*first2, false);
+			++first2;
+		}
+		else
+		{
+			++first1;
+			++first2;
+		}
+	}
+
+	for (; first1 != last1; ++first1)
+		func(*first1, true);
+
+	for (; first2 != last2; ++first2)
+		func(*first2, false);
+}
\ No newline at end of file
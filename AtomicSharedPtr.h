@@ -0,0 +1,272 @@
+#pragma once
+
+#include "SharedPtr.h"
+
+// Slot holding a shared pointer which may be loaded and replaced concurrently, e.g. to publish configuration
+// snapshots read at any IRQL up to DISPATCH_LEVEL. The pointer lives in a node allocated per store, so the slot
+// is a single word and is swapped by one interlocked operation. Readers take the node by split reference counting:
+// the low bits of the slot, vacant due to pool alignment, count loads in flight. A load increments them, copies
+// the pointer out of the node and decrements them back. A store exchanging the node transfers the count in flight
+// to the reference count of the old node, and each late reader drops one such reference instead. Late readers may
+// come before the transfer, so the count starts at zero and the node is freed by whoever brings it back to zero.
+// Thus neither side waits for the other unless as many loads as the low bits hold are in flight.
+template
+<
+	typename Type,
+	POOL_TYPE Pool,
+	typename Deleter = KDefaultDelete<Type>,
+	typename Allocator = KDefaultNew<sharedPtrCounterTag, Pool, Type>
+> class KAtomicSharedPtr
+{
+	CLASS_NO_COPY(KAtomicSharedPtr)
+public:
+	typedef KSharedPtr<Type, Pool, Deleter, Allocator> Shared_t;
+
+	enum CompareResult_t
+	{
+		CompareExchanged,
+		CompareMismatch,
+		CompareNoMemory
+	};
+
+	explicit KAtomicSharedPtr()
+		: m_slot(NULL)
+	{
+	}
+
+	~KAtomicSharedPtr()
+	{
+		Retire(InterlockedExchangePointer(&m_slot, NULL), 0);
+	}
+
+	// Returns a copy of the pointer stored or an invalid one if the slot is empty.
+	__drv_maxIRQL(DISPATCH_LEVEL)
+	Shared_t Load()
+	{
+		Node_t* node = Acquire();
+		if (!node)
+			return Empty();
+
+		Shared_t val(node->value);
+		Release(node);
+
+		return val;
+	}
+
+	// Replaces the pointer stored. Returns false if the node could not be allocated, the slot is left intact then.
+	__checkReturn_opt
+	__drv_maxIRQL(DISPATCH_LEVEL)
+	bool Store(__in const Shared_t& val)
+	{
+		Node_t* node = NULL;
+		if (!CreateNode(val, &node))
+			return false;
+
+		Retire(InterlockedExchangePointer(&m_slot, node), 0);
+		return true;
+	}
+
+	// Replaces the pointer stored and returns the previous one. The slot owns a reference to the old node,
+	// so the pointer is copied out before the node is retired.
+	__checkReturn_opt
+	__drv_maxIRQL(DISPATCH_LEVEL)
+	bool Exchange(__in const Shared_t& val, __out Shared_t* prev)
+	{
+		Node_t* node = NULL;
+		if (!CreateNode(val, &node))
+			return false;
+
+		PVOID old = InterlockedExchangePointer(&m_slot, node);
+		Node_t* oldNode = GetNode(old);
+
+		Assign(prev, oldNode);
+		Retire(old, 0);
+
+		return true;
+	}
+
+	// Stores the desired pointer if the slot holds the same object as the expected one. Otherwise copies
+	// the pointer stored to the expected one and returns CompareMismatch. Pointers are compared by the object
+	// they point to. CompareNoMemory means the node could not be allocated and nothing was compared, so retry
+	// loops must stop on it rather than spin.
+	__checkReturn
+	__drv_maxIRQL(DISPATCH_LEVEL)
+	CompareResult_t CompareExchange(__inout Shared_t& expected, __in const Shared_t& desired)
+	{
+		Node_t* node = NULL;
+		if (!CreateNode(desired, &node))
+			return CompareNoMemory;
+
+		for (;;)
+		{
+			Node_t* current = Acquire();
+			if (GetObject(current) != expected.Get())
+			{
+				Assign(&expected, current);
+				Release(current);
+				Free(node);
+
+				return CompareMismatch;
+			}
+
+			// Loads in flight come and go, so the exchange is retried until either it succeeds
+			// or another node has been stored meanwhile.
+			PVOID slot = m_slot;
+			while (GetNode(slot) == current)
+			{
+				PVOID prev = InterlockedCompareExchangePointer(&m_slot, node, slot);
+				if (prev == slot)
+				{
+					// Own load is among the ones in flight and is not turned into a reference.
+					Retire(slot, 1);
+					return CompareExchanged;
+				}
+
+				slot = prev;
+			}
+
+			Release(current);
+		}
+	}
+
+	bool IsEmpty()
+	{
+		return GetNode(m_slot) == NULL;
+	}
+
+private:
+	struct Node_t
+	{
+		volatile LONG refCount;
+		Shared_t value;
+
+		explicit Node_t(const Shared_t& val)
+			: refCount(0)
+			, value(val)
+		{
+		}
+	};
+
+	// Pool aligns allocations, so the low bits of a node address are zero.
+	static const ULONG_PTR s_countMask = MEMORY_ALLOCATION_ALIGNMENT - 1;
+
+private:
+	static Node_t* GetNode(__in_opt PVOID slot)
+	{
+		return reinterpret_cast<Node_t*>(reinterpret_cast<ULONG_PTR>(slot) & ~s_countMask);
+	}
+
+	static ULONG_PTR GetCount(__in_opt PVOID slot)
+	{
+		return reinterpret_cast<ULONG_PTR>(slot) & s_countMask;
+	}
+
+	static Type* GetObject(__in_opt Node_t* node)
+	{
+		return (node) ? node->value.Get() : NULL;
+	}
+
+	static Shared_t Empty()
+	{
+		return Shared_t(static_cast<KSharedCounter*>(NULL), static_cast<Type*>(NULL));
+	}
+
+	static void Assign(__out Shared_t* dest, __in_opt Node_t* node)
+	{
+		if (node)
+			*dest = node->value;
+		else
+			*dest = Empty();
+	}
+
+	// Empty pointers are stored as an empty slot rather than a node.
+	__checkReturn
+	static bool CreateNode(__in const Shared_t& val, __out Node_t** node)
+	{
+		*node = NULL;
+		if (!val.m_counter)
+			return true;
+
+		*node = new (sharedPtrCounterTag, NonPagedPool) Node_t(val);
+		ASSERT(*node);
+
+		if (!*node)
+			return false;
+
+		ASSERT(GetCount(*node) == 0);
+		return true;
+	}
+
+	static void Free(__in_opt Node_t* node)
+	{
+		delete node;
+	}
+
+	// Counts a load in flight on the node stored and returns the node, which stays alive until released.
+	Node_t* Acquire()
+	{
+		PVOID slot = m_slot;
+		for (;;)
+		{
+			if (!GetNode(slot))
+				return NULL;
+
+			if (GetCount(slot) == s_countMask)
+			{
+				YieldProcessor();
+				slot = m_slot;
+				continue;
+			}
+
+			PVOID next = reinterpret_cast<PVOID>(reinterpret_cast<ULONG_PTR>(slot) + 1);
+			PVOID prev = InterlockedCompareExchangePointer(&m_slot, next, slot);
+			if (prev == slot)
+				return GetNode(slot);
+
+			slot = prev;
+		}
+	}
+
+	// Takes the load back off the slot. If the node has been replaced meanwhile, the load has been turned
+	// into a reference of the node, which is dropped instead.
+	void Release(__in_opt Node_t* node)
+	{
+		if (!node)
+			return;
+
+		PVOID slot = m_slot;
+		while (GetNode(slot) == node)
+		{
+			PVOID next = reinterpret_cast<PVOID>(reinterpret_cast<ULONG_PTR>(slot) - 1);
+			PVOID prev = InterlockedCompareExchangePointer(&m_slot, next, slot);
+			if (prev == slot)
+				return;
+
+			slot = prev;
+		}
+
+		Dereference(node);
+	}
+
+	// Caller has taken the slot value off the slot. Loads in flight but the given number of own ones become references
+	// of the node. Late readers dropped theirs before are already counted below zero.
+	static void Retire(__in_opt PVOID slot, __in LONG own)
+	{
+		Node_t* node = GetNode(slot);
+		if (!node)
+			return;
+
+		LONG delta = static_cast<LONG>(GetCount(slot)) - own;
+		if (InterlockedExchangeAdd(&node->refCount, delta) + delta == 0)
+			Free(node);
+	}
+
+	static void Dereference(__in Node_t* node)
+	{
+		if (InterlockedDecrement(&node->refCount) == 0)
+			Free(node);
+	}
+
+private:
+	volatile PVOID m_slot;
+};
\ No newline at end of file
@@ -30,6 +30,29 @@ public:
 	{
 	}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	// Ownership moves out of temporaries as well, e.g. a pointer returned by value.
+	KAutoPtr(KAutoPtr&& other)
+		: m_obj(other.Release())
+	{
+	}
+
+	template<typename OtherType> KAutoPtr(KAutoPtr<OtherType>&& other)
+		: m_obj(other.Release())
+	{
+	}
+
+	KAutoPtr& operator=(KAutoPtr&& other)
+	{
+		return operator = (static_cast< KAutoPtr& >(other));
+	}
+
+	template<typename OtherType> KAutoPtr& operator=(KAutoPtr<OtherType>&& other)
+	{
+		return operator = (static_cast< KAutoPtr<OtherType>& >(other));
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
 	KAutoPtr& operator=(const KAutoPtr& other)
 	{
 		return operator = (const_cast< KAutoPtr& >(other));
@@ -3,12 +3,21 @@
 #include "CommonDefinitions.h"
 #include "Synch.h"
 #include "Allocator.h"
-
-template <typename ConcreteTree, typename Lock, typename Alloc> class KAvlTree : public RTL_AVL_TABLE
+#include "Utility.h"
+
+template
+<
+	typename ConcreteTree,
+	typename Lock,
+	typename Alloc,
+	typename KeyOf = KIdentityKey<typename Alloc::Val_t>
+> class KAvlTree : public RTL_AVL_TABLE
 {
 	CLASS_NO_COPY(KAvlTree)
 public:
+	typedef Lock Lock_t;
 	typedef Alloc Alloc_t;
+	typedef typename KeyOf::Key_t Key_t;
 	typedef typename Alloc::Val_t Val_t;
 	typedef typename Alloc::Ref_t Ref_t;
 	typedef typename Alloc::CRef_t CRef_t;
@@ -17,6 +26,12 @@ public:
 	typedef ptrdiff_t Dif_t;
 	typedef size_t Size_t;
 
+	// Item found or inserted and flag telling whether it has been inserted by the call.
+	typedef KPair<Ptr_t, bool> InsertResult_t;
+
+	// Begin(), Find() and stepping take the lock shared for the call only, so the lock must not be held
+	// across them. Nothing keeps the current item alive between calls, hence erasing it invalidates
+	// the iterator. Walks which must see a stable tree belong in ForEach() or ForRange().
 	class Iter_t
 	{
 		friend class KAvlTree;
@@ -37,9 +52,13 @@ public:
 		{
 		}
 
+		// The restart key lives in the iterator rather than in the table, so stepping does not modify the tree
+		// and any number of iterators may advance in parallel under the shared lock.
 		Iter_t& operator++()
 		{
-			m_current = reinterpret_cast<Ptr_t>(RtlEnumerateGenericTableAvl(m_target, m_current == NULL));
+			KSharedLocker<Lock> locker(m_target->m_lock);
+			PVOID restartKey = (m_current) ? GetNode(m_current) : NULL;
+			m_current = reinterpret_cast<Ptr_t>(RtlEnumerateGenericTableWithoutSplayingAvl(m_target, &restartKey));
 			return *this;
 		}
 
@@ -71,6 +90,9 @@ public:
 		}
 	};
 
+	// Half-open range of iterators.
+	typedef KPair<Iter_t, Iter_t> Range_t;
+
 	explicit KAvlTree()
 	{
 		RtlInitializeGenericTableAvl(this, &KAvlTree::CompareRoutine, &KAvlTree::AllocateRoutine, &KAvlTree::FreeRoutine, this);
@@ -78,23 +100,40 @@ public:
 
 	~KAvlTree() {}
 
+	// The whole tree goes away, so nodes are freed in post-order without rebalancing after every removal.
 	__drv_mustHold(Lock)
 	void Cleanup()
 	{
-		KLocker<Lock> locker(m_lock);
-		for (PVOID p = RtlEnumerateGenericTableAvl(this, TRUE); p;
-			p = RtlEnumerateGenericTableAvl(this, FALSE))
-		{
-			RtlDeleteElementGenericTableAvl(this, p);
-		}
+		KExclusiveLocker<Lock> locker(m_lock);
+		LockedFreeSubtree(BalancedRoot.RightChild);
+
+		BalancedRoot.RightChild = NULL;
+		OrderedPointer = NULL;
+		WhichOrderedElement = 0;
+		NumberGenericTableElements = 0;
+		DepthOfTree = 0;
+		RestartKey = NULL;
+		DeleteCount++;
+	}
+
+	// Builds the tree out of items sorted by key in ascending order in O(n) time. Nodes are linked
+	// straight into a balanced shape, so neither searching nor rebalancing takes place per item.
+	// Unless the tree is empty and keys strictly ascend the items are inserted one by one instead.
+	// Returns false if some item could not be allocated. The fast path leaves the tree empty then.
+	template <typename Iter>
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	bool BuildFromSorted(__in Iter first, __in Iter last)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		return LockedBuildFromSorted(first, last);
 	}
 
 	__drv_mustHold(Lock)
 	Size_t GetSize()
 	{
-		KLocker<Lock> locker(m_lock);
-		ULONG len = RtlNumberGenericTableElementsAvl(this);
-		return len;
+		KSharedLocker<Lock> locker(m_lock);
+		return LockedGetSize();
 	}
 
 	bool IsEmpty()
@@ -106,50 +145,83 @@ public:
 	__drv_mustHold(Lock)
 	bool Insert(__in CRef_t val, __in Ptr_t* res = NULL)
 	{
-		KLocker<Lock> locker(m_lock);
-		BOOLEAN inserted = FALSE;
-		PVOID raw = RtlInsertElementGenericTableAvl(this, reinterpret_cast<PVOID>(const_cast<Ptr_t>(&val)), sizeof(val), &inserted);
-		if (!raw)
+		InsertResult_t inserted = FindOrInsert(val);
+		if (!inserted.second)
 			return false;
 
-		// Since we deal with C style function accepting flat buffer no guarantee that new item initialized properly.
-		// Thus apply copy constructor to fulfill new item's initialization.
-		if (inserted)
-			static_cast<ConcreteTree*>(this)->OnInsert(raw, val);
-		else
+		// Return new item if the caller interested therein.
+		if (res)
+			*res = inserted.first;
+
+		return true;
+	}
+
+	// Looks the item up and inserts it if absent within a single lock acquisition and a single tree walk.
+	// The first member of the result is NULL only when the new item could not be allocated.
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	InsertResult_t FindOrInsert(__in CRef_t val)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		return LockedFindOrInsert(val);
+	}
+
+#if defined(CXX11_MOVE_SEMANTICS)
+	// Same as above yet the item is moved into the tree if inserted.
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	bool Insert(__in Val_t&& val, __in Ptr_t* res = NULL)
+	{
+		InsertResult_t inserted = FindOrInsert(::Move(val));
+		if (!inserted.second)
 			return false;
 
-		// Return new item if the caller interested therein.
 		if (res)
-			*res = reinterpret_cast<Ptr_t>(raw);
+			*res = inserted.first;
 
 		return true;
 	}
 
 	__checkReturn_opt
 	__drv_mustHold(Lock)
-	bool Erase(__in CRef_t val)
+	InsertResult_t FindOrInsert(__in Val_t&& val)
 	{
-		KLocker<Lock> locker(m_lock);
-		BOOLEAN deleted = RtlDeleteElementGenericTableAvl(this, reinterpret_cast<PVOID>(const_cast<Ptr_t>(&val)));
+		KExclusiveLocker<Lock> locker(m_lock);
+		return LockedFindOrInsert(::Move(val));
+	}
+#endif // CXX11_MOVE_SEMANTICS
 
-		return deleted == TRUE;
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	bool Erase(__in const Key_t& key)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		return LockedErase(key);
 	}
 
 	__checkReturn
-	Iter_t Find(__in CRef_t val)
+	__drv_mustHold(Lock)
+	Iter_t Find(__in const Key_t& key)
 	{
-		Ptr_t item = Lookup(val);
-		Iter_t iterator(this);
-		iterator.m_current = (item) ? item : NULL;
+		KSharedLocker<Lock> locker(m_lock);
+		return LockedFind(key);
+	}
 
-		return iterator;
+	__checkReturn
+	__drv_mustHold(Lock)
+	bool Contains(__in const Key_t& key)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		return Lookup(key) != NULL;
 	}
 
+	__drv_mustHold(Lock)
 	Iter_t Begin()
 	{
+		KSharedLocker<Lock> locker(m_lock);
+		PVOID restartKey = NULL;
 		Iter_t iterator(this);
-		iterator.m_current = reinterpret_cast<Ptr_t>(RtlEnumerateGenericTableAvl(this, TRUE));
+		iterator.m_current = reinterpret_cast<Ptr_t>(RtlEnumerateGenericTableWithoutSplayingAvl(this, &restartKey));
 		return iterator;
 	}
 
@@ -159,24 +231,410 @@ public:
 		return iterator;
 	}
 
+	// Ordered range queries. A bound is located by a single search which also yields the neighbour
+	// of an absent key, and then iteration proceeds from there. Nothing is splayed or otherwise changed
+	// in the tree, hence a range of k items costs O(log n + k) under the shared lock.
+
+	// First item whose key is not less than given one.
+	__checkReturn
+	__drv_mustHold(Lock)
+	Iter_t LowerBound(__in const Key_t& key)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		Iter_t iterator(this);
+		iterator.m_current = LockedLowerBound(key);
+		return iterator;
+	}
+
+	// First item whose key is greater than given one.
+	__checkReturn
+	__drv_mustHold(Lock)
+	Iter_t UpperBound(__in const Key_t& key)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		Iter_t iterator(this);
+		iterator.m_current = LockedUpperBound(key);
+		return iterator;
+	}
+
+	// Keys are unique, so the range holds either a single item or none.
+	__checkReturn
+	__drv_mustHold(Lock)
+	Range_t EqualRange(__in const Key_t& key)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		Iter_t first(this);
+		Iter_t last(this);
+
+		first.m_current = LockedLowerBound(key);
+		last.m_current = first.m_current;
+		if (first.m_current && IsEqual(KeyOf::Get(*first.m_current), key))
+			last.m_current = LockedNext(first.m_current);
+
+		return Range_t(first, last);
+	}
+
+	// Calls the functor for every item with key in [first, last) in ascending order within a single lock acquisition.
+	// The functor receives Ref_t of the item and must not call back into the tree.
+	template <typename Func>
+	__drv_mustHold(Lock)
+	void ForRange(__in const Key_t& first, __in const Key_t& last, __in Func& func)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		for (Ptr_t item = LockedLowerBound(first); item && IsLess(KeyOf::Get(*item), last); item = LockedNext(item))
+			func(*item);
+	}
+
+	// Calls the functor for every item in ascending order within a single lock acquisition rather than locking
+	// per step as iterators do. Enumeration does not splay, so walks may run in parallel under the shared lock.
+	// The functor receives Ref_t of the item and must not call back into the tree.
+	template <typename Func>
+	__drv_mustHold(Lock)
+	void ForEach(__in Func& func)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		LockedForEach(func);
+	}
+
+	// Lookups, bounds and iterators take the lock by themselves, so holding it across them self-deadlocks
+	// on an exclusive lock.
 	Lock& GetLock()
 	{
 		return m_lock;
 	}
 
 protected:
+	// Locked counterparts of the public calls for adapters serializing several steps under one acquisition.
+	// Caller must hold the lock, exclusively for the modifying ones.
+	template <typename Iter>
+	__checkReturn_opt
+	bool LockedBuildFromSorted(__in Iter first, __in Iter last)
+	{
+		ULONG count = 0;
+		bool sorted = true;
+
+		for (Iter prev = first, it = first; it != last; prev = it, ++it, ++count)
+		{
+			if (count && !IsLess(KeyOf::Get(*prev), KeyOf::Get(*it)))
+				sorted = false;
+		}
+
+		if (!sorted || BalancedRoot.RightChild)
+		{
+			bool res = true;
+			for (Iter it = first; it != last; ++it)
+			{
+				if (!LockedFindOrInsert(*it).first)
+					res = false;
+			}
+
+			return res;
+		}
+
+		PRTL_BALANCED_LINKS root = NULL;
+		ULONG depth = 0;
+		if (!LockedBuildSubtree(first, count, &root, &depth))
+			return false;
+
+		if (root)
+			root->Parent = &BalancedRoot;
+
+		BalancedRoot.RightChild = root;
+		NumberGenericTableElements = count;
+		DepthOfTree = depth;
+
+		return true;
+	}
+
+	__checkReturn_opt
+	bool LockedErase(__in const Key_t& key)
+	{
+		BOOLEAN deleted = RtlDeleteElementGenericTableAvl(this, GetProbe(key));
+		return deleted == TRUE;
+	}
+
+	__checkReturn
+	Iter_t LockedFind(__in const Key_t& key)
+	{
+		Iter_t iterator(this);
+		iterator.m_current = Lookup(key);
+		return iterator;
+	}
+
+	Size_t LockedGetSize()
+	{
+		return RtlNumberGenericTableElementsAvl(this);
+	}
+
+	template <typename Func> void LockedForEach(__in Func& func)
+	{
+		PVOID restartKey = NULL;
+		for (PVOID item = RtlEnumerateGenericTableWithoutSplayingAvl(this, &restartKey); item;
+			item = RtlEnumerateGenericTableWithoutSplayingAvl(this, &restartKey))
+		{
+			func(*reinterpret_cast<Ptr_t>(item));
+		}
+	}
+
+	// Caller must hold the lock. Insertion reuses the parent node and the side found by the lookup
+	// so the tree is not searched again.
+	__checkReturn
+	InsertResult_t LockedFindOrInsert(__in CRef_t val)
+	{
+		PVOID nodeOrParent = NULL;
+		TABLE_SEARCH_RESULT searchResult = TableEmptyTree;
+
+		Ptr_t item = LockedLookup(KeyOf::Get(val), &nodeOrParent, &searchResult);
+		if (item)
+			return InsertResult_t(item, false);
+
+		return LockedInsertAt(val, nodeOrParent, searchResult);
+	}
+
+#if defined(CXX11_MOVE_SEMANTICS)
+	__checkReturn
+	InsertResult_t LockedFindOrInsert(__in Val_t&& val)
+	{
+		PVOID nodeOrParent = NULL;
+		TABLE_SEARCH_RESULT searchResult = TableEmptyTree;
+
+		Ptr_t item = LockedLookup(KeyOf::Get(val), &nodeOrParent, &searchResult);
+		if (item)
+			return InsertResult_t(item, false);
+
+		return LockedInsertAt(::Move(val), nodeOrParent, searchResult);
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
+	// Caller must hold the lock. Besides the item found returns the position where the key should be inserted.
+	__checkReturn
+	Ptr_t LockedLookup(__in const Key_t& key, __out PVOID* nodeOrParent, __out TABLE_SEARCH_RESULT* searchResult)
+	{
+		return reinterpret_cast<Ptr_t>(RtlLookupElementGenericTableFullAvl(this, GetProbe(key), nodeOrParent, searchResult));
+	}
+
+	// Caller must hold the lock and pass the position obtained by LockedLookup() under the same lock acquisition.
+	__checkReturn
+	InsertResult_t LockedInsertAt(__in CRef_t val, __in PVOID nodeOrParent, __in TABLE_SEARCH_RESULT searchResult)
+	{
+		PVOID raw = LockedInsertRaw(val, nodeOrParent, searchResult);
+		if (!raw)
+			return InsertResult_t(NULL, false);
+
+		// Since we deal with C style function accepting flat buffer no guarantee that new item initialized properly.
+		// Thus apply copy constructor to fulfill new item's initialization.
+		static_cast<ConcreteTree*>(this)->OnInsert(raw, val);
+
+		return InsertResult_t(reinterpret_cast<Ptr_t>(raw), true);
+	}
+
+#if defined(CXX11_MOVE_SEMANTICS)
+	__checkReturn
+	InsertResult_t LockedInsertAt(__in Val_t&& val, __in PVOID nodeOrParent, __in TABLE_SEARCH_RESULT searchResult)
+	{
+		PVOID raw = LockedInsertRaw(val, nodeOrParent, searchResult);
+		if (!raw)
+			return InsertResult_t(NULL, false);
+
+		static_cast<ConcreteTree*>(this)->OnInsert(raw, ::Move(val));
+
+		return InsertResult_t(reinterpret_cast<Ptr_t>(raw), true);
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
+	// Links a node of the item size at the position, its payload is initialized by the caller.
+	__checkReturn
+	PVOID LockedInsertRaw(__in CRef_t val, __in PVOID nodeOrParent, __in TABLE_SEARCH_RESULT searchResult)
+	{
+		BOOLEAN inserted = FALSE;
+		return RtlInsertElementGenericTableFullAvl(this, reinterpret_cast<PVOID>(const_cast<Ptr_t>(&val)), sizeof(val),
+			&inserted, nodeOrParent, searchResult);
+	}
+
+	// Caller must hold the lock exclusively. Consumes count items of the sequence building a subtree of them.
+	// Left part takes count / 2 items, the larger half if the rest but the root is odd, and the right part
+	// the remaining count - count / 2 - 1. Sizes of sibling subtrees differ by one at most, so do their heights,
+	// which keeps balance factors within AVL bounds. On failure everything built so far is freed.
+	template <typename Iter>
 	__checkReturn
-	Ptr_t Lookup(__in CRef_t val)
+	bool LockedBuildSubtree(__inout Iter& it, __in ULONG count, __out PRTL_BALANCED_LINKS* subtree, __out ULONG* height)
 	{
-		Ptr_t item = reinterpret_cast<Ptr_t>(RtlLookupElementGenericTableAvl(this, reinterpret_cast<PVOID>(const_cast<Ptr_t>(&val))));
+		*subtree = NULL;
+		*height = 0;
+
+		if (!count)
+			return true;
+
+		PRTL_BALANCED_LINKS left = NULL;
+		ULONG leftHeight = 0;
+		if (!LockedBuildSubtree(it, count / 2, &left, &leftHeight))
+			return false;
+
+		PRTL_BALANCED_LINKS node = reinterpret_cast<PRTL_BALANCED_LINKS>(AllocateRoutine(this, sizeof(RTL_BALANCED_LINKS) + sizeof(Val_t)));
+		if (!node)
+		{
+			LockedFreeSubtree(left);
+			return false;
+		}
+
+		RtlZeroMemory(node, sizeof(RTL_BALANCED_LINKS));
+		static_cast<ConcreteTree*>(this)->OnInsert(GetItem(node), *it);
+		++it;
+
+		PRTL_BALANCED_LINKS right = NULL;
+		ULONG rightHeight = 0;
+		if (!LockedBuildSubtree(it, count - count / 2 - 1, &right, &rightHeight))
+		{
+			LockedFreeSubtree(left);
+			FreeRoutine(this, node);
+			return false;
+		}
+
+		node->LeftChild = left;
+		node->RightChild = right;
+
+		if (left)
+			left->Parent = node;
+
+		if (right)
+			right->Parent = node;
+
+		node->Balance = static_cast<CHAR>(static_cast<LONG>(rightHeight) - static_cast<LONG>(leftHeight));
+
+		*subtree = node;
+		*height = ((leftHeight > rightHeight) ? leftHeight : rightHeight) + 1;
+
+		return true;
+	}
+
+	// Caller must hold the lock exclusively. Frees the subtree bottom up walking parent links, so no stack
+	// is needed whatever the depth. Links pointing to the subtree from outside are left for the caller to fix.
+	void LockedFreeSubtree(__in PRTL_BALANCED_LINKS subtree)
+	{
+		PRTL_BALANCED_LINKS node = subtree;
+		while (node)
+		{
+			if (node->LeftChild)
+			{
+				node = node->LeftChild;
+				continue;
+			}
+
+			if (node->RightChild)
+			{
+				node = node->RightChild;
+				continue;
+			}
+
+			PRTL_BALANCED_LINKS parent = (node != subtree) ? node->Parent : NULL;
+			if (parent)
+			{
+				if (parent->LeftChild == node)
+					parent->LeftChild = NULL;
+				else
+					parent->RightChild = NULL;
+			}
+
+			FreeRoutine(this, node);
+			node = parent;
+		}
+	}
+
+	// Caller must hold the lock, either shared or exclusive. AVL lookup neither splays nor otherwise modifies
+	// the table, so parallel lookups are safe.
+	__checkReturn
+	Ptr_t Lookup(__in const Key_t& key)
+	{
+		Ptr_t item = reinterpret_cast<Ptr_t>(RtlLookupElementGenericTableAvl(this, GetProbe(key)));
 		return item;
 	}
 
+	// Caller must hold the lock, either shared or exclusive.
+	__checkReturn
+	Ptr_t LockedLowerBound(__in const Key_t& key)
+	{
+		PVOID nodeOrParent = NULL;
+		TABLE_SEARCH_RESULT searchResult = TableEmptyTree;
+
+		Ptr_t item = LockedLookup(key, &nodeOrParent, &searchResult);
+		if (item)
+			return item;
+
+		return LockedBoundFromParent(nodeOrParent, searchResult);
+	}
+
+	__checkReturn
+	Ptr_t LockedUpperBound(__in const Key_t& key)
+	{
+		PVOID nodeOrParent = NULL;
+		TABLE_SEARCH_RESULT searchResult = TableEmptyTree;
+
+		Ptr_t item = LockedLookup(key, &nodeOrParent, &searchResult);
+		if (item)
+			return LockedNext(item);
+
+		return LockedBoundFromParent(nodeOrParent, searchResult);
+	}
+
+	// Translates position of an absent key into the first item greater than the key. Left child of the parent
+	// is vacant, so the parent itself follows the key. Right child is vacant, so the key falls between the parent
+	// and its successor.
+	__checkReturn
+	Ptr_t LockedBoundFromParent(__in PVOID parent, __in TABLE_SEARCH_RESULT searchResult)
+	{
+		switch (searchResult)
+		{
+		case TableInsertAsLeft:
+			return GetItem(parent);
+
+		case TableInsertAsRight:
+			return LockedNext(GetItem(parent));
+
+		default:
+			return NULL;
+		}
+	}
+
+	__checkReturn
+	Ptr_t LockedNext(__in Ptr_t item)
+	{
+		PVOID restartKey = GetNode(item);
+		return reinterpret_cast<Ptr_t>(RtlEnumerateGenericTableWithoutSplayingAvl(this, &restartKey));
+	}
+
+	bool IsLess(__in const Key_t& x, __in const Key_t& y)
+	{
+		return static_cast<ConcreteTree*>(this)->OnCompare(x, y) == GenericLessThan;
+	}
+
+	bool IsEqual(__in const Key_t& x, __in const Key_t& y)
+	{
+		return static_cast<ConcreteTree*>(this)->OnCompare(x, y) == GenericEqual;
+	}
+
+	static PVOID GetProbe(__in const Key_t& key)
+	{
+		return reinterpret_cast<PVOID>(const_cast<Key_t*>(&key));
+	}
+
+	// The table places payload straight after the balanced links of the node.
+	static PVOID GetNode(__in Ptr_t item)
+	{
+		return reinterpret_cast<PUCHAR>(item) - sizeof(RTL_BALANCED_LINKS);
+	}
+
+	static Ptr_t GetItem(__in PVOID node)
+	{
+		return reinterpret_cast<Ptr_t>(reinterpret_cast<PUCHAR>(node) + sizeof(RTL_BALANCED_LINKS));
+	}
+
+	// Every search passes a key rather than an item as the buffer, thus the first argument is always a key probe
+	// and the second one is an item of the table. Insertion reuses the search result and never compares.
 	__checkReturn
 	static RTL_GENERIC_COMPARE_RESULTS CompareRoutine(__in PRTL_AVL_TABLE self, __in PVOID first, __in PVOID second)
 	{
-		return static_cast<ConcreteTree*>(self)->OnCompare(*reinterpret_cast<Ptr_t>(first),
-			*reinterpret_cast<Ptr_t>(second));
+		return static_cast<ConcreteTree*>(self)->OnCompare(*reinterpret_cast<const Key_t*>(first),
+			KeyOf::Get(*reinterpret_cast<Ptr_t>(second)));
 	}
 
 	__checkReturn
@@ -246,6 +704,15 @@ public:
 		inst = val;
 	}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	void OnInsert(__in PVOID raw, __in Val_t&& val)
+	{
+		m_allocator.Construct(raw);
+		Ref_t inst = *reinterpret_cast<Ptr_t>(raw);
+		inst = ::Move(val);
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
 protected:
 	Alloc& m_allocator;
 };
@@ -323,6 +790,15 @@ public:
 		inst = val;
 	}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	void OnInsert(__in PVOID raw, __in Val_t&& val)
+	{
+		Ptr_t p = new (raw)Val_t();
+		Ref_t inst = *p;
+		inst = ::Move(val);
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
 protected:
 	void Reset(typename Alloc::template Rebind_t<Item_t>::Other_t* allocator)
 	{
@@ -0,0 +1,919 @@
+#pragma once
+
+#include "CommonDefinitions.h"
+#include "Synch.h"
+#include "Allocator.h"
+#include "Utility.h"
+#include "Functional.h"
+
+// Ordered map laid out as B+tree. Keys of a node are stored contiguously and searched with the inlined
+// comparator, so a lookup touches a few cache lines per level rather than a node per comparison.
+// Items live in leaves only and leaves are linked in key order, hence ordered scans walk them sequentially.
+// Key and T must be default constructible and assignable since node arrays hold them by value.
+// Any modification of the map invalidates iterators.
+template
+<
+	typename Key,
+	typename T,
+	typename Lock,
+	typename Alloc,
+	typename Less = KLess<Key>,
+	ULONG NodeSize = 512
+> class KBTreeMap
+{
+	CLASS_NO_COPY(KBTreeMap)
+
+	C_ASSERT(NodeSize >= 128);
+public:
+	typedef Key Key_t;
+	typedef T Mapped_t;
+	typedef size_t Size_t;
+
+	// Mapped value found or inserted and flag telling whether it has been inserted by the call.
+	typedef KPair<Mapped_t*, bool> InsertResult_t;
+
+	struct Node_t
+	{
+		ULONG count;
+
+		Node_t()
+			: count(0)
+		{
+		}
+	};
+
+	// Capacities are derived from the node size. Every array has a spare slot which receives an item
+	// right before the node gets split, so insertion never needs a temporary buffer.
+	static const ULONG s_leafFit = static_cast<ULONG>((NodeSize - sizeof(Node_t) - 2 * sizeof(PVOID)) / (sizeof(Key) + sizeof(T)));
+	static const ULONG s_innerFit = static_cast<ULONG>((NodeSize - sizeof(Node_t) - 2 * sizeof(PVOID)) / (sizeof(Key) + sizeof(PVOID)));
+	static const ULONG s_leafCapacity = (s_leafFit > 5) ? (s_leafFit - 1) : 4;
+	static const ULONG s_innerCapacity = (s_innerFit > 5) ? (s_innerFit - 1) : 4;
+
+	struct Leaf_t : public Node_t
+	{
+		Leaf_t* prev;
+		Leaf_t* next;
+		Key_t keys[s_leafCapacity + 1];
+		Mapped_t values[s_leafCapacity + 1];
+
+		Leaf_t()
+			: prev(NULL)
+			, next(NULL)
+		{
+		}
+	};
+
+	// Subtree of children[i] holds keys less than keys[i] and not less than keys[i - 1].
+	struct Inner_t : public Node_t
+	{
+		Key_t keys[s_innerCapacity + 1];
+		Node_t* children[s_innerCapacity + 2];
+
+		Inner_t()
+		{
+			RtlZeroMemory(children, sizeof(children));
+		}
+	};
+
+	// Keys and values live in separate arrays, so the item an iterator refers to is a pair of references
+	// rather than a stored KPair. It offers the first and second members KMap iterators do.
+	struct Item_t
+	{
+		const Key_t& first;
+		Mapped_t& second;
+
+		Item_t(const Key_t& key, Mapped_t& val)
+			: first(key)
+			, second(val)
+		{
+		}
+	};
+
+	// Returned by Iter_t::operator->() to hold the item while its members are accessed.
+	class ItemPtr_t
+	{
+		Item_t m_item;
+
+	public:
+		explicit ItemPtr_t(const Item_t& item)
+			: m_item(item)
+		{
+		}
+
+		Item_t* operator -> ()
+		{
+			return &m_item;
+		}
+	};
+
+	class Iter_t
+	{
+		friend class KBTreeMap;
+
+		KBTreeMap* m_target;
+		Leaf_t* m_leaf;
+		ULONG m_index;
+
+	public:
+		Iter_t(KBTreeMap* target)
+			: m_target(target)
+			, m_leaf(NULL)
+			, m_index(0)
+		{
+		}
+
+		Iter_t(const Iter_t& other)
+			: m_target(other.m_target)
+			, m_leaf(other.m_leaf)
+			, m_index(other.m_index)
+		{
+		}
+
+		// Stepping past the end stays at the end.
+		Iter_t& operator++()
+		{
+			if (!m_leaf)
+				return *this;
+
+			KSharedLocker<Lock> locker(m_target->m_lock);
+			if (++m_index >= m_leaf->count)
+			{
+				m_leaf = m_leaf->next;
+				m_index = 0;
+			}
+
+			return *this;
+		}
+
+		Iter_t operator++(int)
+		{
+			Iter_t tmp(*this);
+			operator++();
+			return tmp;
+		}
+
+		bool operator == (const Iter_t& other) const
+		{
+			return (m_leaf == other.m_leaf) && (m_index == other.m_index);
+		}
+
+		bool operator != (const Iter_t& other) const
+		{
+			return !operator == (other);
+		}
+
+		const Key_t& GetKey() const
+		{
+			return m_leaf->keys[m_index];
+		}
+
+		Mapped_t& GetValue()
+		{
+			return m_leaf->values[m_index];
+		}
+
+		Item_t operator * ()
+		{
+			return Item_t(m_leaf->keys[m_index], m_leaf->values[m_index]);
+		}
+
+		ItemPtr_t operator -> ()
+		{
+			return ItemPtr_t(operator*());
+		}
+	};
+
+	explicit KBTreeMap()
+		: m_root(NULL)
+		, m_head(NULL)
+		, m_height(0)
+		, m_count(0)
+		, m_nullObj()
+	{
+	}
+
+	~KBTreeMap()
+	{
+		Cleanup();
+	}
+
+	__drv_mustHold(Lock)
+	void Cleanup()
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		if (m_root)
+			FreeSubtree(m_root, m_height);
+
+		m_root = NULL;
+		m_head = NULL;
+		m_height = 0;
+		m_count = 0;
+	}
+
+	__drv_mustHold(Lock)
+	Size_t GetSize()
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		return m_count;
+	}
+
+	bool IsEmpty()
+	{
+		return GetSize() == 0;
+	}
+
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	bool Insert(__in const Key_t& key, __in const Mapped_t& mapped)
+	{
+		return TryEmplace(key, mapped).second;
+	}
+
+	// Inserts the key with given mapped value unless the key is present already. Existing item is left untouched.
+	// The first member of the result is NULL only when a node could not be allocated.
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	InsertResult_t TryEmplace(__in const Key_t& key, __in const Mapped_t& mapped)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		InsertResult_t res = LockedFindOrInsert(key);
+		if (res.second)
+			*res.first = mapped;
+
+		return res;
+	}
+
+	// Same as above yet the mapped value of the new item is left default constructed.
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	InsertResult_t TryEmplace(__in const Key_t& key)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		return LockedFindOrInsert(key);
+	}
+
+	// Inserts the key or overwrites mapped value of the existing item.
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	InsertResult_t InsertOrAssign(__in const Key_t& key, __in const Mapped_t& mapped)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		InsertResult_t res = LockedFindOrInsert(key);
+		if (res.first)
+			*res.first = mapped;
+
+		return res;
+	}
+
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	Mapped_t& operator[] (__in const Key_t& key)
+	{
+		InsertResult_t res = TryEmplace(key);
+		if (res.first)
+			return *res.first;
+		else
+			return m_nullObj;
+	}
+
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	bool Erase(__in const Key_t& key)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		return LockedErase(key);
+	}
+
+	__checkReturn
+	__drv_mustHold(Lock)
+	Iter_t Find(__in const Key_t& key)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		Iter_t iterator(this);
+		if (!m_root)
+			return iterator;
+
+		Leaf_t* leaf = LockedDescend(key, NULL, NULL);
+		ULONG index = LowerIndex(leaf->keys, leaf->count, key);
+		if ((index < leaf->count) && !m_less(key, leaf->keys[index]))
+		{
+			iterator.m_leaf = leaf;
+			iterator.m_index = index;
+		}
+
+		return iterator;
+	}
+
+	__checkReturn
+	__drv_mustHold(Lock)
+	bool Contains(__in const Key_t& key)
+	{
+		return Find(key) != End();
+	}
+
+	__drv_mustHold(Lock)
+	Iter_t Begin()
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		Iter_t iterator(this);
+		iterator.m_leaf = m_head;
+		return iterator;
+	}
+
+	Iter_t End()
+	{
+		Iter_t iterator(this);
+		return iterator;
+	}
+
+	// First item whose key is not less than given one.
+	__checkReturn
+	__drv_mustHold(Lock)
+	Iter_t LowerBound(__in const Key_t& key)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		Iter_t iterator(this);
+		LockedBound(key, false, &iterator.m_leaf, &iterator.m_index);
+		return iterator;
+	}
+
+	// First item whose key is greater than given one.
+	__checkReturn
+	__drv_mustHold(Lock)
+	Iter_t UpperBound(__in const Key_t& key)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		Iter_t iterator(this);
+		LockedBound(key, true, &iterator.m_leaf, &iterator.m_index);
+		return iterator;
+	}
+
+	// Calls the functor for every item with key in [first, last) in ascending order within a single lock acquisition.
+	// The functor receives the key and reference to the mapped value and must not call back into the map.
+	template <typename Func>
+	__drv_mustHold(Lock)
+	void ForRange(__in const Key_t& first, __in const Key_t& last, __in Func& func)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		Leaf_t* leaf = NULL;
+		ULONG index = 0;
+
+		for (LockedBound(first, false, &leaf, &index); leaf; leaf = leaf->next, index = 0)
+		{
+			for (; index < leaf->count; index++)
+			{
+				if (!m_less(leaf->keys[index], last))
+					return;
+
+				func(leaf->keys[index], leaf->values[index]);
+			}
+		}
+	}
+
+	Lock& GetLock()
+	{
+		return m_lock;
+	}
+
+private:
+	typedef typename Alloc::template Rebind_t<Leaf_t>::Other_t LeafAlloc_t;
+	typedef typename Alloc::template Rebind_t<Inner_t>::Other_t InnerAlloc_t;
+
+	// Inner nodes but the root hold at least half of their capacity, so fanout never drops below three.
+	// That bounds the height far below the limit for any number of items fitting the address space.
+	static const ULONG s_maxDepth = 32;
+	static const ULONG s_minLeaf = s_leafCapacity / 2;
+	static const ULONG s_minInner = s_innerCapacity / 2;
+
+private:
+	// First slot whose key is not less than given one. Every step at least halves the slots left, so a search
+	// takes log2(count) + 1 steps at most, though the exact number depends on the branches taken.
+	ULONG LowerIndex(__in const Key_t* keys, __in ULONG count, __in const Key_t& key) const
+	{
+		ULONG first = 0;
+		while (count)
+		{
+			ULONG half = count / 2;
+			if (m_less(keys[first + half], key))
+			{
+				first += half + 1;
+				count -= half + 1;
+			}
+			else
+			{
+				count = half;
+			}
+		}
+
+		return first;
+	}
+
+	// First slot whose key is greater than given one.
+	ULONG UpperIndex(__in const Key_t* keys, __in ULONG count, __in const Key_t& key) const
+	{
+		ULONG first = 0;
+		while (count)
+		{
+			ULONG half = count / 2;
+			if (!m_less(key, keys[first + half]))
+			{
+				first += half + 1;
+				count -= half + 1;
+			}
+			else
+			{
+				count = half;
+			}
+		}
+
+		return first;
+	}
+
+	// Caller must hold the lock and make sure the tree is not empty. Descends to the leaf which
+	// may hold the key recording inner nodes passed along with child slots taken if asked to.
+	Leaf_t* LockedDescend(__in const Key_t& key, __out_opt Inner_t** path, __out_opt ULONG* slots)
+	{
+		Node_t* node = m_root;
+		for (ULONG level = 0; level < m_height; level++)
+		{
+			Inner_t* inner = static_cast<Inner_t*>(node);
+			ULONG slot = UpperIndex(inner->keys, inner->count, key);
+
+			if (path)
+			{
+				path[level] = inner;
+				slots[level] = slot;
+			}
+
+			node = inner->children[slot];
+		}
+
+		return static_cast<Leaf_t*>(node);
+	}
+
+	// Caller must hold the lock, either shared or exclusive. Separators never exceed keys of the right subtree,
+	// so if the bound is beyond the last key of the leaf it is the first key of the next one.
+	void LockedBound(__in const Key_t& key, __in bool upper, __out Leaf_t** leaf, __out ULONG* index)
+	{
+		*leaf = NULL;
+		*index = 0;
+
+		if (!m_root)
+			return;
+
+		Leaf_t* target = LockedDescend(key, NULL, NULL);
+		ULONG slot = (upper) ? UpperIndex(target->keys, target->count, key) : LowerIndex(target->keys, target->count, key);
+		if (slot >= target->count)
+		{
+			target = target->next;
+			slot = 0;
+		}
+
+		*leaf = target;
+		*index = (target) ? slot : 0;
+	}
+
+	// Caller must hold the lock exclusively. Nodes which are going to be split are allocated before
+	// the tree is touched, so an allocation failure leaves the tree intact.
+	__checkReturn
+	InsertResult_t LockedFindOrInsert(__in const Key_t& key)
+	{
+		if (!m_root)
+		{
+			Leaf_t* root = AllocateLeaf();
+			if (!root)
+				return InsertResult_t(NULL, false);
+
+			m_root = root;
+			m_head = root;
+		}
+
+		Inner_t* path[s_maxDepth];
+		ULONG slots[s_maxDepth];
+
+		Leaf_t* leaf = LockedDescend(key, path, slots);
+		ULONG index = LowerIndex(leaf->keys, leaf->count, key);
+		if ((index < leaf->count) && !m_less(key, leaf->keys[index]))
+			return InsertResult_t(&leaf->values[index], false);
+
+		Leaf_t* spareLeaf = NULL;
+		Inner_t* spareInners[s_maxDepth + 1];
+		ULONG spareCount = 0;
+
+		if (leaf->count == s_leafCapacity)
+		{
+			ULONG level = m_height;
+			while ((level > 0) && (path[level - 1]->count == s_innerCapacity))
+				level--;
+
+			// Split reaching the root grows the tree by a level.
+			ULONG needed = m_height - level + ((level == 0) ? 1 : 0);
+			ASSERT(m_height + 1 < s_maxDepth);
+
+			spareLeaf = AllocateLeaf();
+			for (; spareLeaf && (spareCount < needed); spareCount++)
+			{
+				spareInners[spareCount] = AllocateInner();
+				if (!spareInners[spareCount])
+					break;
+			}
+
+			if (!spareLeaf || (spareCount < needed))
+			{
+				if (spareLeaf)
+					FreeLeaf(spareLeaf);
+
+				while (spareCount)
+					FreeInner(spareInners[--spareCount]);
+
+				return InsertResult_t(NULL, false);
+			}
+		}
+
+		ShiftRight(leaf->keys, index, leaf->count);
+		ShiftRight(leaf->values, index, leaf->count);
+		leaf->keys[index] = key;
+		leaf->values[index] = Mapped_t();
+		leaf->count++;
+		m_count++;
+
+		if (leaf->count <= s_leafCapacity)
+			return InsertResult_t(&leaf->values[index], true);
+
+		// Upper half of the leaf moves to the new right sibling.
+		Leaf_t* right = spareLeaf;
+		ULONG leftCount = leaf->count / 2;
+		MoveItems(right->keys, 0, leaf->keys, leftCount, leaf->count - leftCount);
+		MoveItems(right->values, 0, leaf->values, leftCount, leaf->count - leftCount);
+		right->count = leaf->count - leftCount;
+		leaf->count = leftCount;
+		ResetLeafTail(leaf, leftCount);
+
+		right->prev = leaf;
+		right->next = leaf->next;
+		if (leaf->next)
+			leaf->next->prev = right;
+
+		leaf->next = right;
+
+		Mapped_t* res = (index < leftCount) ? &leaf->values[index] : &right->values[index - leftCount];
+
+		Key_t separator = right->keys[0];
+		Node_t* child = right;
+		ULONG spareUsed = 0;
+
+		for (ULONG level = m_height; level > 0; level--)
+		{
+			Inner_t* parent = path[level - 1];
+			ULONG slot = slots[level - 1];
+
+			ShiftRight(parent->keys, slot, parent->count);
+			ShiftRight(parent->children, slot + 1, parent->count + 1);
+			parent->keys[slot] = separator;
+			parent->children[slot + 1] = child;
+			parent->count++;
+
+			if (parent->count <= s_innerCapacity)
+			{
+				child = NULL;
+				break;
+			}
+
+			// Middle key moves up, keys on the right of it move to the new sibling along with their children.
+			Inner_t* sibling = spareInners[spareUsed++];
+			ULONG mid = parent->count / 2;
+
+			separator = parent->keys[mid];
+			MoveItems(sibling->keys, 0, parent->keys, mid + 1, parent->count - mid - 1);
+			MoveItems(sibling->children, 0, parent->children, mid + 1, parent->count - mid);
+			sibling->count = parent->count - mid - 1;
+			parent->count = mid;
+
+			child = sibling;
+		}
+
+		if (child)
+		{
+			Inner_t* root = spareInners[spareUsed++];
+			root->keys[0] = separator;
+			root->children[0] = m_root;
+			root->children[1] = child;
+			root->count = 1;
+
+			m_root = root;
+			m_height++;
+		}
+
+		ASSERT(spareUsed == spareCount);
+
+		return InsertResult_t(res, true);
+	}
+
+	// Caller must hold the lock exclusively. Underflown node borrows an item from a sibling or merges with it,
+	// and only a merge may make the parent underflow in turn.
+	__checkReturn
+	bool LockedErase(__in const Key_t& key)
+	{
+		if (!m_root)
+			return false;
+
+		Inner_t* path[s_maxDepth];
+		ULONG slots[s_maxDepth];
+
+		Leaf_t* leaf = LockedDescend(key, path, slots);
+		ULONG index = LowerIndex(leaf->keys, leaf->count, key);
+		if ((index >= leaf->count) || m_less(key, leaf->keys[index]))
+			return false;
+
+		MoveItems(leaf->keys, index, leaf->keys, index + 1, leaf->count - index - 1);
+		MoveItems(leaf->values, index, leaf->values, index + 1, leaf->count - index - 1);
+		leaf->count--;
+		ResetLeafTail(leaf, leaf->count);
+		m_count--;
+
+		Node_t* node = leaf;
+		for (ULONG level = m_height; level > 0; level--)
+		{
+			bool isLeaf = (level == m_height);
+			if (node->count >= ((isLeaf) ? s_minLeaf : s_minInner))
+				break;
+
+			Inner_t* parent = path[level - 1];
+			bool merged = (isLeaf) ? RebalanceLeaf(parent, slots[level - 1]) : RebalanceInner(parent, slots[level - 1]);
+			if (!merged)
+				break;
+
+			node = parent;
+		}
+
+		// Root is allowed to underflow until it gets empty. The only child of an empty inner root becomes the root.
+		if (!m_height)
+		{
+			if (!leaf->count)
+			{
+				FreeLeaf(leaf);
+				m_root = NULL;
+				m_head = NULL;
+			}
+		}
+		else if (!m_root->count)
+		{
+			Inner_t* root = static_cast<Inner_t*>(m_root);
+			m_root = root->children[0];
+			m_height--;
+			FreeInner(root);
+		}
+
+		return true;
+	}
+
+	// Returns true if the leaf has been merged with a sibling, so the parent lost a key.
+	bool RebalanceLeaf(__in Inner_t* parent, __in ULONG slot)
+	{
+		Leaf_t* leaf = static_cast<Leaf_t*>(parent->children[slot]);
+		Leaf_t* left = (slot > 0) ? static_cast<Leaf_t*>(parent->children[slot - 1]) : NULL;
+		Leaf_t* right = (slot < parent->count) ? static_cast<Leaf_t*>(parent->children[slot + 1]) : NULL;
+
+		if (left && (left->count > s_minLeaf))
+		{
+			ShiftRight(leaf->keys, 0, leaf->count);
+			ShiftRight(leaf->values, 0, leaf->count);
+			leaf->keys[0] = left->keys[left->count - 1];
+			leaf->values[0] = left->values[left->count - 1];
+			leaf->count++;
+
+			left->count--;
+			ResetLeafTail(left, left->count);
+			parent->keys[slot - 1] = leaf->keys[0];
+
+			return false;
+		}
+
+		if (right && (right->count > s_minLeaf))
+		{
+			leaf->keys[leaf->count] = right->keys[0];
+			leaf->values[leaf->count] = right->values[0];
+			leaf->count++;
+
+			MoveItems(right->keys, 0, right->keys, 1, right->count - 1);
+			MoveItems(right->values, 0, right->values, 1, right->count - 1);
+			right->count--;
+			ResetLeafTail(right, right->count);
+			parent->keys[slot] = right->keys[0];
+
+			return false;
+		}
+
+		if (left)
+		{
+			MergeLeaves(left, leaf);
+			RemoveSeparator(parent, slot - 1);
+		}
+		else
+		{
+			MergeLeaves(leaf, right);
+			RemoveSeparator(parent, slot);
+		}
+
+		return true;
+	}
+
+	// Returns true if the node has been merged with a sibling, so the parent lost a key.
+	bool RebalanceInner(__in Inner_t* parent, __in ULONG slot)
+	{
+		Inner_t* node = static_cast<Inner_t*>(parent->children[slot]);
+		Inner_t* left = (slot > 0) ? static_cast<Inner_t*>(parent->children[slot - 1]) : NULL;
+		Inner_t* right = (slot < parent->count) ? static_cast<Inner_t*>(parent->children[slot + 1]) : NULL;
+
+		// Borrowing rotates the item through the parent since the separator lies between the siblings.
+		if (left && (left->count > s_minInner))
+		{
+			ShiftRight(node->keys, 0, node->count);
+			ShiftRight(node->children, 0, node->count + 1);
+			node->keys[0] = parent->keys[slot - 1];
+			node->children[0] = left->children[left->count];
+			node->count++;
+
+			parent->keys[slot - 1] = left->keys[left->count - 1];
+			left->count--;
+
+			return false;
+		}
+
+		if (right && (right->count > s_minInner))
+		{
+			node->keys[node->count] = parent->keys[slot];
+			node->children[node->count + 1] = right->children[0];
+			node->count++;
+
+			parent->keys[slot] = right->keys[0];
+			MoveItems(right->keys, 0, right->keys, 1, right->count - 1);
+			MoveItems(right->children, 0, right->children, 1, right->count);
+			right->count--;
+
+			return false;
+		}
+
+		if (left)
+		{
+			MergeInners(left, parent->keys[slot - 1], node);
+			RemoveSeparator(parent, slot - 1);
+		}
+		else
+		{
+			MergeInners(node, parent->keys[slot], right);
+			RemoveSeparator(parent, slot);
+		}
+
+		return true;
+	}
+
+	void MergeLeaves(__in Leaf_t* dst, __in Leaf_t* src)
+	{
+		MoveItems(dst->keys, dst->count, src->keys, 0, src->count);
+		MoveItems(dst->values, dst->count, src->values, 0, src->count);
+		dst->count += src->count;
+
+		dst->next = src->next;
+		if (src->next)
+			src->next->prev = dst;
+
+		FreeLeaf(src);
+	}
+
+	// Separator of the parent comes down between the keys of merged nodes.
+	void MergeInners(__in Inner_t* dst, __in const Key_t& separator, __in Inner_t* src)
+	{
+		dst->keys[dst->count] = separator;
+		MoveItems(dst->keys, dst->count + 1, src->keys, 0, src->count);
+		MoveItems(dst->children, dst->count + 1, src->children, 0, src->count + 1);
+		dst->count += src->count + 1;
+
+		FreeInner(src);
+	}
+
+	// Removes the key at given slot along with the child on the right of it.
+	void RemoveSeparator(__in Inner_t* node, __in ULONG slot)
+	{
+		MoveItems(node->keys, slot, node->keys, slot + 1, node->count - slot - 1);
+		MoveItems(node->children, slot + 1, node->children, slot + 2, node->count - slot - 1);
+		node->count--;
+	}
+
+	// Vacant slots get default values so that the leaf does not keep copies of items moved or erased.
+	static void ResetLeafTail(__in Leaf_t* leaf, __in ULONG from)
+	{
+		for (ULONG i = from; i <= s_leafCapacity; i++)
+		{
+			leaf->keys[i] = Key_t();
+			leaf->values[i] = Mapped_t();
+		}
+	}
+
+	// Makes room at given slot moving count - index items one slot to the right.
+	template <typename U> static void ShiftRight(__inout U* items, __in ULONG index, __in ULONG count)
+	{
+		for (ULONG i = count; i > index; i--)
+			items[i] = items[i - 1];
+	}
+
+	// Forward copy, so it is fine to move items towards the beginning of the same array.
+	template <typename U> static void MoveItems(__out U* dst, __in ULONG dstIndex, __in const U* src, __in ULONG srcIndex, __in ULONG count)
+	{
+		for (ULONG i = 0; i < count; i++)
+			dst[dstIndex + i] = src[srcIndex + i];
+	}
+
+	__checkReturn
+	Leaf_t* AllocateLeaf()
+	{
+		Leaf_t* leaf = m_leafAllocator.Allocate(sizeof(Leaf_t));
+		ASSERT(leaf);
+
+		if (leaf)
+			m_leafAllocator.Construct(leaf);
+
+		return leaf;
+	}
+
+	__checkReturn
+	Inner_t* AllocateInner()
+	{
+		Inner_t* inner = m_innerAllocator.Allocate(sizeof(Inner_t));
+		ASSERT(inner);
+
+		if (inner)
+			m_innerAllocator.Construct(inner);
+
+		return inner;
+	}
+
+	void FreeLeaf(__in Leaf_t* leaf)
+	{
+		m_leafAllocator.Destroy(leaf);
+		m_leafAllocator.Deallocate(leaf);
+	}
+
+	void FreeInner(__in Inner_t* inner)
+	{
+		m_innerAllocator.Destroy(inner);
+		m_innerAllocator.Deallocate(inner);
+	}
+
+	// Recursion depth is bounded by the tree height.
+	void FreeSubtree(__in Node_t* node, __in ULONG height)
+	{
+		if (!height)
+		{
+			FreeLeaf(static_cast<Leaf_t*>(node));
+			return;
+		}
+
+		Inner_t* inner = static_cast<Inner_t*>(node);
+		for (ULONG i = 0; i <= inner->count; i++)
+			FreeSubtree(inner->children[i], height - 1);
+
+		FreeInner(inner);
+	}
+
+private:
+	Lock m_lock;
+	LeafAlloc_t m_leafAllocator;
+	InnerAlloc_t m_innerAllocator;
+	Node_t* m_root;
+	Leaf_t* m_head;
+	ULONG m_height;
+	Size_t m_count;
+	Less m_less;
+	Mapped_t m_nullObj;
+};
+
+template <typename K, typename T> struct KPagedPoolBTreeMap
+{
+	typedef KBTreeMap< K, T, KGuardedMutex, typename KPagedPoolAllocator< KPair<K, T> >::Type > Type;
+};
+
+template <typename K, typename T> struct KNonPagedPoolBTreeMap
+{
+	typedef KBTreeMap< K, T, KSpinLock, typename KNonPagedPoolAllocator< KPair<K, T> >::Type > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KTaggedPagedPoolBTreeMap
+{
+	typedef KBTreeMap< K, T, KGuardedMutex, typename KTaggedPagedPoolAllocator< KPair<K, T>, Tag >::Type > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KTaggedNonPagedPoolBTreeMap
+{
+	typedef KBTreeMap< K, T, KSpinLock, typename KTaggedNonPagedPoolAllocator< KPair<K, T>, Tag >::Type > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KPagedLookasideBTreeMap
+{
+	typedef KBTreeMap< K, T, KGuardedMutex, KPagedLookasideAllocator< KPair<K, T>, Tag > > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KNonPagedLookasideBTreeMap
+{
+	typedef KBTreeMap< K, T, KSpinLock, KNonPagedLookasideAllocator< KPair<K, T>, Tag > > Type;
+};
\ No newline at end of file
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "CommonDefinitions.h"
+#include "Allocator.h"
+#include "Utility.h"
+
+// Blocked Bloom filter answering whether a hash might have been added. Every hash maps to a single
+// 512-bit block aligned to its size, so a probe touches one cache line only, and sets one bit in each
+// of its 16 words. Bit positions come from multiplications by fixed odd salts, which are independent
+// of each other and compile to a few vector instructions where available.
+// The filter never reports an added hash as absent. It works with hashes rather than keys, so
+// the caller chooses the hash function. The allocator must serve requests of arbitrary size.
+template <typename Alloc> class KBloomFilter
+{
+	CLASS_NO_COPY(KBloomFilter)
+public:
+	typedef size_t Size_t;
+
+	explicit KBloomFilter()
+		: m_buffer(NULL)
+		, m_blocks(NULL)
+		, m_blockCount(0)
+		, m_capacity(0)
+		, m_count(0)
+	{
+	}
+
+	~KBloomFilter()
+	{
+		Cleanup();
+	}
+
+	// Sizes the filter for given number of hashes so that the rate of false positives stays below
+	// given number per million probes. The rate is an integer, since floating point is not freely
+	// available in the kernel. Previous contents is dropped. On failure the filter is left empty
+	// and reports every hash as present.
+	__checkReturn
+	bool Initialize(__in Size_t capacity, __in ULONG falsePositivesPerMillion)
+	{
+		Cleanup();
+
+		Size_t bits = ((capacity) ? capacity : 1) * GetBitsPerKey(falsePositivesPerMillion);
+		ULONG blockCount = static_cast<ULONG>((bits + s_blockBits - 1) / s_blockBits);
+
+		// Pool does not align small allocations to the cache line, so an extra block leaves room for that.
+		Size_t size = (blockCount + 1) * sizeof(Block_t);
+		m_buffer = m_allocator.Allocate(size);
+		if (!m_buffer)
+			return false;
+
+		RtlZeroMemory(m_buffer, size);
+
+		ULONG_PTR aligned = (reinterpret_cast<ULONG_PTR>(m_buffer) + sizeof(Block_t) - 1) & ~static_cast<ULONG_PTR>(sizeof(Block_t) - 1);
+		m_blocks = reinterpret_cast<Block_t*>(aligned);
+		m_blockCount = blockCount;
+		m_capacity = capacity;
+
+		return true;
+	}
+
+	// Drops every hash keeping the size.
+	void Clear()
+	{
+		if (m_blocks)
+			RtlZeroMemory(m_blocks, m_blockCount * sizeof(Block_t));
+
+		m_count = 0;
+	}
+
+	void Cleanup()
+	{
+		if (m_buffer)
+			m_allocator.Deallocate(m_buffer);
+
+		m_buffer = NULL;
+		m_blocks = NULL;
+		m_blockCount = 0;
+		m_capacity = 0;
+		m_count = 0;
+	}
+
+	// Bits are set with plain stores, so adding must be serialized against both adding and probing.
+	void Add(__in ULONG hash)
+	{
+		m_count++;
+		if (!m_blocks)
+			return;
+
+		Block_t& block = GetBlock(hash);
+		ULONG mix = GetMix(hash);
+
+		for (ULONG i = 0; i < s_wordCount; i++)
+			block.words[i] |= GetMask(mix, i);
+	}
+
+	// All words are tested without early exit, so the loop has no data dependent branches.
+	__checkReturn
+	bool MayContain(__in ULONG hash) const
+	{
+		if (!m_blocks)
+			return true;
+
+		const Block_t& block = GetBlock(hash);
+		ULONG mix = GetMix(hash);
+		ULONG missing = 0;
+
+		for (ULONG i = 0; i < s_wordCount; i++)
+			missing |= ~block.words[i] & GetMask(mix, i);
+
+		return missing == 0;
+	}
+
+	bool IsInitialized() const
+	{
+		return m_blocks != NULL;
+	}
+
+	// Number of hashes the filter has been sized for.
+	Size_t GetCapacity() const
+	{
+		return m_capacity;
+	}
+
+	// Number of hashes added since the filter has been initialized or cleared, counting repeated ones.
+	Size_t GetCount() const
+	{
+		return m_count;
+	}
+
+	// Bits per hash needed for 16 bits set in a 512-bit block to keep false positives within the rate.
+	// Thresholds are precomputed from the Poisson distribution of hashes over blocks.
+	static ULONG GetBitsPerKey(__in ULONG falsePositivesPerMillion)
+	{
+		static const ULONG table[][2] =
+		{
+			{ 100000, 9 },
+			{ 50000, 10 },
+			{ 20000, 12 },
+			{ 10000, 13 },
+			{ 5000, 14 },
+			{ 2000, 16 },
+			{ 1000, 18 },
+			{ 500, 19 },
+			{ 200, 22 },
+			{ 100, 24 },
+			{ 50, 25 },
+			{ 20, 28 },
+			{ 10, 31 }
+		};
+
+		for (ULONG i = 0; i < RTL_NUMBER_OF(table); i++)
+		{
+			if (falsePositivesPerMillion >= table[i][0])
+				return table[i][1];
+		}
+
+		return 32;
+	}
+
+private:
+	static const ULONG s_wordCount = 16;
+	static const ULONG s_blockBits = s_wordCount * 32;
+
+	struct Block_t
+	{
+		ULONG words[s_wordCount];
+	};
+
+	C_ASSERT(sizeof(Block_t) == s_blockBits / 8);
+
+	typedef typename Alloc::template Rebind_t<UCHAR>::Other_t BufferAlloc_t;
+
+	static const ULONG s_salts[s_wordCount];
+
+private:
+	// High bits of the product spread the hash over blocks of any count without division.
+	Block_t& GetBlock(__in ULONG hash) const
+	{
+		return m_blocks[static_cast<ULONG>((static_cast<ULONGLONG>(hash) * m_blockCount) >> 32)];
+	}
+
+	// Bits within the block are taken from a remix of the hash, so they do not correlate with the block index.
+	static ULONG GetMix(__in ULONG hash)
+	{
+		return HashMix(hash ^ 0x9e3779b9);
+	}
+
+	static ULONG GetMask(__in ULONG mix, __in ULONG word)
+	{
+		return 1UL << ((mix * s_salts[word]) >> 27);
+	}
+
+private:
+	BufferAlloc_t m_allocator;
+	PUCHAR m_buffer;
+	Block_t* m_blocks;
+	ULONG m_blockCount;
+	Size_t m_capacity;
+	Size_t m_count;
+};
+
+template <typename Alloc> const ULONG KBloomFilter<Alloc>::s_salts[KBloomFilter<Alloc>::s_wordCount] =
+{
+	0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d, 0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31,
+	0x5425b7b3, 0x0ef15213, 0xfbb3e84f, 0x055665f1, 0xf5913f13, 0xcd268111, 0xeb174f65, 0xe8cd8ad5
+};
\ No newline at end of file
@@ -27,6 +27,18 @@ typedef int POOL_TYPE;
 
 #endif // USER_MODE_TEST
 
+#ifndef SYSTEM_CACHE_ALIGNMENT_SIZE
+#define SYSTEM_CACHE_ALIGNMENT_SIZE 64
+#endif // SYSTEM_CACHE_ALIGNMENT_SIZE
+
+// Older WDKs lack the macro. Used to keep frequently written data of different processors apart.
+#ifndef DECLSPEC_CACHEALIGN
+#define DECLSPEC_CACHEALIGN DECLSPEC_ALIGN(SYSTEM_CACHE_ALIGNMENT_SIZE)
+#endif // DECLSPEC_CACHEALIGN
+
+// Move semantics are opt-in, since older WDKs compile C++03 only. Define CXX11_MOVE_SEMANTICS in the project
+// settings to have smart pointers and containers move values rather than copy them.
+
 #define CLASS_NO_COPY(type)				\
 	type(const type&){}					\
 	type& operator = (const type&) { return *this; }
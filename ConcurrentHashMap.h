@@ -0,0 +1,345 @@
+#pragma once
+
+#include "CommonDefinitions.h"
+#include "Synch.h"
+#include "Allocator.h"
+#include "Utility.h"
+
+// Hash map split into independently locked shards. A key is routed to the shard by its hash,
+// so threads working with different shards never touch the same lock. Each shard owns its bucket
+// array and grows it on its own, thus rehashing blocks the keys of a single shard only.
+// The allocator must serve requests of arbitrary size since bucket arrays are allocated through it.
+template
+<
+	typename Key,
+	typename T,
+	typename Lock,
+	typename Alloc,
+	ULONG ShardCount = 16,
+	typename Hash = KHash<Key>
+> class KConcurrentHashMap
+{
+	CLASS_NO_COPY(KConcurrentHashMap)
+
+	C_ASSERT((ShardCount != 0) && ((ShardCount & (ShardCount - 1)) == 0));
+public:
+	typedef Key Key_t;
+	typedef T Mapped_t;
+	typedef typename Alloc::Val_t Val_t;
+	typedef typename Alloc::Ref_t Ref_t;
+	typedef typename Alloc::CRef_t CRef_t;
+	typedef typename Alloc::Ptr_t Ptr_t;
+	typedef typename Alloc::CPtr_t CPtr_t;
+	typedef size_t Size_t;
+
+	struct Node_t
+	{
+		Node_t* next;
+		ULONG hash;
+		Val_t object;
+
+		Node_t()
+			: next(NULL)
+			, hash(0)
+			, object()
+		{
+		}
+
+		~Node_t() {}
+	};
+
+	typedef Node_t* NodePtr_t;
+
+	explicit KConcurrentHashMap() {}
+
+	~KConcurrentHashMap()
+	{
+		Cleanup();
+	}
+
+	__checkReturn_opt
+	bool Insert(__in const Key_t& key, __in const Mapped_t& val)
+	{
+		ULONG hash = m_hash(key);
+		Shard_t& shard = GetShard(hash);
+		KExclusiveLocker<Lock> locker(shard.lock);
+
+		if (Lookup(shard, key, hash))
+			return false;
+
+		return Link(shard, key, val, hash) != NULL;
+	}
+
+	__checkReturn_opt
+	bool InsertOrAssign(__in const Key_t& key, __in const Mapped_t& val)
+	{
+		ULONG hash = m_hash(key);
+		Shard_t& shard = GetShard(hash);
+		KExclusiveLocker<Lock> locker(shard.lock);
+
+		NodePtr_t node = Lookup(shard, key, hash);
+		if (node)
+		{
+			node->object.second = val;
+			return true;
+		}
+
+		return Link(shard, key, val, hash) != NULL;
+	}
+
+	// The value is copied out under the shard lock since the node may vanish as soon as the lock is released.
+	__checkReturn
+	bool Find(__in const Key_t& key, __out_opt Mapped_t* val = NULL)
+	{
+		ULONG hash = m_hash(key);
+		Shard_t& shard = GetShard(hash);
+		KSharedLocker<Lock> locker(shard.lock);
+
+		NodePtr_t node = Lookup(shard, key, hash);
+		if (!node)
+			return false;
+
+		if (val)
+			*val = node->object.second;
+
+		return true;
+	}
+
+	__checkReturn
+	bool Contains(__in const Key_t& key)
+	{
+		return Find(key);
+	}
+
+	__checkReturn_opt
+	bool Erase(__in const Key_t& key)
+	{
+		ULONG hash = m_hash(key);
+		Shard_t& shard = GetShard(hash);
+		KExclusiveLocker<Lock> locker(shard.lock);
+
+		if (!shard.buckets)
+			return false;
+
+		NodePtr_t* link = &shard.buckets[GetBucketIndex(hash, shard.bucketCount)];
+		for (NodePtr_t node = *link; node; link = &node->next, node = node->next)
+		{
+			if ((node->hash == hash) && (node->object.first == key))
+			{
+				*link = node->next;
+				Free(shard, node);
+				InterlockedDecrement(&shard.count);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Visits shards one at a time holding a single shard lock at once, so writers to other shards proceed.
+	// The functor receives Ref_t of each item and must neither block nor call back into the map.
+	template <typename Func> void ForEach(Func& func)
+	{
+		for (ULONG i = 0; i < ShardCount; i++)
+		{
+			Shard_t& shard = m_shards[i];
+			KExclusiveLocker<Lock> locker(shard.lock);
+
+			if (!shard.buckets)
+				continue;
+
+			for (ULONG j = 0; j < shard.bucketCount; j++)
+			{
+				for (NodePtr_t node = shard.buckets[j]; node; node = node->next)
+					func(node->object);
+			}
+		}
+	}
+
+	// Approximate number of items. Shard counters are read without locking, hence the result
+	// may be stale by the time it returns. Still it is cheap enough to be polled at any rate.
+	Size_t GetCount() const
+	{
+		Size_t res = 0;
+		for (ULONG i = 0; i < ShardCount; i++)
+			res += m_shards[i].count;
+
+		return res;
+	}
+
+	bool IsEmpty() const
+	{
+		return GetCount() == 0;
+	}
+
+	void Cleanup()
+	{
+		for (ULONG i = 0; i < ShardCount; i++)
+		{
+			Shard_t& shard = m_shards[i];
+			KExclusiveLocker<Lock> locker(shard.lock);
+
+			if (!shard.buckets)
+				continue;
+
+			for (ULONG j = 0; j < shard.bucketCount; j++)
+			{
+				NodePtr_t node = shard.buckets[j];
+				while (node)
+				{
+					NodePtr_t next = node->next;
+					Free(shard, node);
+					node = next;
+				}
+			}
+
+			shard.bucketAllocator.Deallocate(shard.buckets);
+			shard.buckets = NULL;
+			shard.bucketCount = 0;
+			InterlockedExchange(&shard.count, 0);
+		}
+	}
+
+private:
+	typedef typename Alloc::template Rebind_t<Node_t>::Other_t NodeAlloc_t;
+	typedef typename Alloc::template Rebind_t<NodePtr_t>::Other_t BucketAlloc_t;
+
+	static const ULONG s_initialBucketCount = 16;
+
+	// Every shard occupies its own cache lines so that the lock of one shard never shares a line with another one.
+	struct DECLSPEC_CACHEALIGN Shard_t
+	{
+		Lock lock;
+		NodeAlloc_t nodeAllocator;
+		BucketAlloc_t bucketAllocator;
+		NodePtr_t* buckets;
+		ULONG bucketCount;
+		volatile LONG count;
+
+		Shard_t()
+			: buckets(NULL)
+			, bucketCount(0)
+			, count(0)
+		{
+		}
+
+		~Shard_t() {}
+	};
+
+private:
+	Shard_t& GetShard(ULONG hash)
+	{
+		return m_shards[hash & (ShardCount - 1)];
+	}
+
+	// Low bits of the hash select the shard, so the bucket is taken from the remaining ones.
+	static ULONG GetBucketIndex(ULONG hash, ULONG bucketCount)
+	{
+		return (hash / ShardCount) & (bucketCount - 1);
+	}
+
+	__checkReturn
+	NodePtr_t Lookup(Shard_t& shard, const Key_t& key, ULONG hash)
+	{
+		if (!shard.buckets)
+			return NULL;
+
+		for (NodePtr_t node = shard.buckets[GetBucketIndex(hash, shard.bucketCount)]; node; node = node->next)
+		{
+			if ((node->hash == hash) && (node->object.first == key))
+				return node;
+		}
+
+		return NULL;
+	}
+
+	__checkReturn
+	NodePtr_t Link(Shard_t& shard, const Key_t& key, const Mapped_t& val, ULONG hash)
+	{
+		if (static_cast<ULONG>(shard.count) >= shard.bucketCount)
+			Rehash(shard);
+
+		// Bucket array allocation might have failed for the very first item.
+		if (!shard.buckets)
+			return NULL;
+
+		NodePtr_t node = shard.nodeAllocator.Allocate(sizeof(Node_t));
+		ASSERT(node);
+
+		if (!node)
+			return NULL;
+
+		shard.nodeAllocator.Construct(node);
+		node->hash = hash;
+		node->object.first = key;
+		node->object.second = val;
+
+		NodePtr_t& head = shard.buckets[GetBucketIndex(hash, shard.bucketCount)];
+		node->next = head;
+		head = node;
+		InterlockedIncrement(&shard.count);
+
+		return node;
+	}
+
+	void Free(Shard_t& shard, NodePtr_t node)
+	{
+		shard.nodeAllocator.Destroy(node);
+		shard.nodeAllocator.Deallocate(node);
+	}
+
+	// Doubles bucket array of the shard. Nodes keep their hash, so relinking needs no key hashing.
+	// On allocation failure the shard keeps working with the old array at a higher load factor.
+	void Rehash(Shard_t& shard)
+	{
+		ULONG newCount = (shard.bucketCount) ? (shard.bucketCount << 1) : s_initialBucketCount;
+		NodePtr_t* newBuckets = shard.bucketAllocator.Allocate(newCount * sizeof(NodePtr_t));
+		if (!newBuckets)
+			return;
+
+		RtlZeroMemory(newBuckets, newCount * sizeof(NodePtr_t));
+
+		for (ULONG i = 0; i < shard.bucketCount; i++)
+		{
+			NodePtr_t node = shard.buckets[i];
+			while (node)
+			{
+				NodePtr_t next = node->next;
+				NodePtr_t& head = newBuckets[GetBucketIndex(node->hash, newCount)];
+				node->next = head;
+				head = node;
+				node = next;
+			}
+		}
+
+		if (shard.buckets)
+			shard.bucketAllocator.Deallocate(shard.buckets);
+
+		shard.buckets = newBuckets;
+		shard.bucketCount = newCount;
+	}
+
+private:
+	Shard_t m_shards[ShardCount];
+	Hash m_hash;
+};
+
+template <typename K, typename T> struct KPagedPoolConcurrentHashMap
+{
+	typedef KConcurrentHashMap< K, T, KGuardedMutex, typename KPagedPoolAllocator< KPair<K, T> >::Type > Type;
+};
+
+template <typename K, typename T> struct KNonPagedPoolConcurrentHashMap
+{
+	typedef KConcurrentHashMap< K, T, KSpinLock, typename KNonPagedPoolAllocator< KPair<K, T> >::Type > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KTaggedPagedPoolConcurrentHashMap
+{
+	typedef KConcurrentHashMap< K, T, KGuardedMutex, typename KTaggedPagedPoolAllocator< KPair<K, T>, Tag >::Type > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KTaggedNonPagedPoolConcurrentHashMap
+{
+	typedef KConcurrentHashMap< K, T, KSpinLock, typename KTaggedNonPagedPoolAllocator< KPair<K, T>, Tag >::Type > Type;
+};
@@ -0,0 +1,204 @@
+#pragma once
+
+#include "Set.h"
+#include "BloomFilter.h"
+
+// Set answering most negative lookups without walking the tree. Every key is also added to a blocked
+// Bloom filter probed first, so a miss costs a single cache line instead of the whole tree height.
+// Erased keys stay in the filter until it is rebuilt from the tree, which happens once erased keys
+// outnumber live ones. The filter is rebuilt with twice the capacity as it fills up, so its load and hence
+// the rate of false positives stay within the target. Only lookups which pass the filter reach the tree.
+// Modifications go through the adapter only, since the set is inherited privately.
+// The allocator of the filter must serve requests of arbitrary size, thus lookaside sets need a pool one.
+template
+<
+	typename Set,
+	typename Alloc = typename Set::Alloc_t,
+	typename Hash = KHash<typename Set::Key_t>
+> class KFilteredSet : private Set
+{
+	CLASS_NO_COPY(KFilteredSet)
+public:
+	typedef typename Set::Lock_t Lock_t;
+	typedef typename Set::Key_t Key_t;
+	typedef typename Set::Alloc_t::Val_t Val_t;
+	typedef typename Set::Alloc_t::Ref_t Ref_t;
+	typedef typename Set::Alloc_t::CRef_t CRef_t;
+	typedef typename Set::Alloc_t::Ptr_t Ptr_t;
+	typedef typename Set::Alloc_t::CPtr_t CPtr_t;
+	typedef size_t Size_t;
+	typedef typename Set::Iter_t Iter_t;
+	typedef typename Set::Range_t Range_t;
+	typedef typename Set::InsertResult_t InsertResult_t;
+
+	using Set::GetSize;
+	using Set::IsEmpty;
+	using Set::Begin;
+	using Set::End;
+	using Set::LowerBound;
+	using Set::UpperBound;
+	using Set::EqualRange;
+	using Set::ForRange;
+	using Set::ForEach;
+	using Set::GetLock;
+
+	explicit KFilteredSet(__in ULONG falsePositivesPerMillion = 10000)
+		: m_falsePositives(falsePositivesPerMillion)
+		, m_erased(0)
+		, m_rebuildAt(0)
+	{
+	}
+
+	~KFilteredSet() {}
+
+	// Sizes the filter in advance, so that filling the set up to the capacity causes no rebuilds.
+	__checkReturn
+	bool Reserve(__in Size_t capacity)
+	{
+		KExclusiveLocker<Lock_t> locker(this->m_lock);
+		return LockedRebuild(capacity);
+	}
+
+	__checkReturn_opt
+	bool Insert(__in CRef_t val, __in Ptr_t* res = NULL)
+	{
+		InsertResult_t inserted = FindOrInsert(val);
+		if (!inserted.second)
+			return false;
+
+		if (res)
+			*res = inserted.first;
+
+		return true;
+	}
+
+	__checkReturn_opt
+	InsertResult_t FindOrInsert(__in CRef_t val)
+	{
+		KExclusiveLocker<Lock_t> locker(this->m_lock);
+		InsertResult_t inserted = this->LockedFindOrInsert(val);
+		if (inserted.second)
+			LockedAdd(val);
+
+		return inserted;
+	}
+
+	// The filter is rebuilt under the same acquisition the tree is built in, so no lookup meets a stale filter.
+	template <typename Iter>
+	__checkReturn_opt
+	bool BuildFromSorted(__in Iter first, __in Iter last)
+	{
+		KExclusiveLocker<Lock_t> locker(this->m_lock);
+		bool res = this->LockedBuildFromSorted(first, last);
+		LockedRebuild(2 * this->LockedGetSize());
+
+		return res;
+	}
+
+	__checkReturn_opt
+	bool Erase(__in const Key_t& key)
+	{
+		KExclusiveLocker<Lock_t> locker(this->m_lock);
+		if (!this->LockedErase(key))
+			return false;
+
+		// Rebuilding takes time linear in the size, so it is paid for by as many erasures.
+		if (++m_erased > this->LockedGetSize())
+			LockedRebuild(2 * this->LockedGetSize());
+
+		return true;
+	}
+
+	__checkReturn
+	Iter_t Find(__in const Key_t& key)
+	{
+		KSharedLocker<Lock_t> locker(this->m_lock);
+		if (!m_filter.MayContain(m_hash(key)))
+			return End();
+
+		return this->LockedFind(key);
+	}
+
+	__checkReturn
+	bool Contains(__in const Key_t& key)
+	{
+		KSharedLocker<Lock_t> locker(this->m_lock);
+		if (!m_filter.MayContain(m_hash(key)))
+			return false;
+
+		return this->Lookup(key) != NULL;
+	}
+
+	// Until the filter is dropped lookups may pass it in vain, which is harmless.
+	void Cleanup()
+	{
+		Set::Cleanup();
+
+		KExclusiveLocker<Lock_t> locker(this->m_lock);
+		m_filter.Cleanup();
+		m_erased = 0;
+		m_rebuildAt = 0;
+	}
+
+private:
+	static const Size_t s_minCapacity = 64;
+
+	// Adds every item of the tree to the filter.
+	struct Adder_t
+	{
+		KBloomFilter<Alloc>& filter;
+		Hash& hash;
+
+		Adder_t(KBloomFilter<Alloc>& bloom, Hash& func)
+			: filter(bloom)
+			, hash(func)
+		{
+		}
+
+		void operator()(__in CRef_t val)
+		{
+			filter.Add(hash(val));
+		}
+	};
+
+private:
+	// Caller must hold the lock exclusively. The item is already in the tree, so rebuilding covers it.
+	void LockedAdd(__in CRef_t val)
+	{
+		if (m_filter.GetCount() >= m_rebuildAt)
+			LockedRebuild(2 * this->LockedGetSize());
+		else
+			m_filter.Add(m_hash(val));
+	}
+
+	// Caller must hold the lock exclusively. If the filter could not be allocated, every lookup goes to the tree
+	// and the next attempt is made once as many items have been added as the filter should have held.
+	__checkReturn_opt
+	bool LockedRebuild(__in Size_t capacity)
+	{
+		Size_t size = this->LockedGetSize();
+		if (capacity < size)
+			capacity = size;
+
+		if (capacity < s_minCapacity)
+			capacity = s_minCapacity;
+
+		m_erased = 0;
+		m_rebuildAt = capacity;
+
+		if (!m_filter.Initialize(capacity, m_falsePositives))
+			return false;
+
+		Adder_t adder(m_filter, m_hash);
+		this->LockedForEach(adder);
+
+		return true;
+	}
+
+private:
+	KBloomFilter<Alloc> m_filter;
+	Hash m_hash;
+	ULONG m_falsePositives;
+	Size_t m_erased;
+	Size_t m_rebuildAt;
+};
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "FlatTable.h"
+#include "Utility.h"
+
+// Read-mostly counterpart of KMap. Fill it with Insert() calls, call Freeze() and then look it up
+// through the same Find() and iteration interface.
+template <typename Key, typename T, typename Alloc, typename Less = KLess<Key> > class KFlatMap
+: public KFlatTable< Alloc, KSelectFirstKey<typename Alloc::Val_t>, Less >
+{
+	CLASS_NO_COPY(KFlatMap)
+public:
+	typedef Key Key_t;
+	typedef T Mapped_t;
+
+	explicit KFlatMap() {}
+	~KFlatMap() {}
+};
+
+template <typename K, typename T> struct KPagedPoolFlatMap
+{
+	typedef KFlatMap< K, T, typename KPagedPoolAllocator< KPair<K, T> >::Type > Type;
+};
+
+template <typename K, typename T> struct KNonPagedPoolFlatMap
+{
+	typedef KFlatMap< K, T, typename KNonPagedPoolAllocator< KPair<K, T> >::Type > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KTaggedPagedPoolFlatMap
+{
+	typedef KFlatMap< K, T, typename KTaggedPagedPoolAllocator< KPair<K, T>, Tag >::Type > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KTaggedNonPagedPoolFlatMap
+{
+	typedef KFlatMap< K, T, typename KTaggedNonPagedPoolAllocator< KPair<K, T>, Tag >::Type > Type;
+};
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "FlatTable.h"
+
+// Read-mostly counterpart of KSet. Fill it with Insert() calls, call Freeze() and then look it up
+// through the same Find() and iteration interface.
+template <typename T, typename Alloc, typename Less = KLess<T> > class KFlatSet
+: public KFlatTable< Alloc, KIdentityKey<typename Alloc::Val_t>, Less >
+{
+	CLASS_NO_COPY(KFlatSet)
+public:
+	explicit KFlatSet() {}
+	~KFlatSet() {}
+};
+
+template <typename T> struct KPagedPoolFlatSet
+{
+	typedef KFlatSet< T, typename KPagedPoolAllocator< T >::Type > Type;
+};
+
+template <typename T> struct KNonPagedPoolFlatSet
+{
+	typedef KFlatSet< T, typename KNonPagedPoolAllocator< T >::Type > Type;
+};
+
+template <typename T, ULONG Tag> struct KTaggedPagedPoolFlatSet
+{
+	typedef KFlatSet< T, typename KTaggedPagedPoolAllocator< T, Tag >::Type > Type;
+};
+
+template <typename T, ULONG Tag> struct KTaggedNonPagedPoolFlatSet
+{
+	typedef KFlatSet< T, typename KTaggedNonPagedPoolAllocator< T, Tag >::Type > Type;
+};
\ No newline at end of file
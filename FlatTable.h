@@ -0,0 +1,291 @@
+#pragma once
+
+#include "CommonDefinitions.h"
+#include "Allocator.h"
+#include "Utility.h"
+#include "Functional.h"
+#include "Algorithm.h"
+#include "Vector.h"
+
+// Sorted array of items for tables built once and read many times afterwards. Items are appended
+// in any order and then Freeze() sorts them, so lookups deal with a single contiguous array
+// instead of nodes spread over the pool. Frozen table never changes, thus readers take no lock.
+// The table must be built and frozen by a single thread before it is published to readers.
+// The allocator must serve requests of arbitrary size since arrays are allocated through it.
+template <typename Alloc, typename KeyOf, typename Less> class KFlatTable
+{
+	CLASS_NO_COPY(KFlatTable)
+public:
+	typedef Alloc Alloc_t;
+	typedef typename KeyOf::Key_t Key_t;
+	typedef typename Alloc::Val_t Val_t;
+	typedef typename Alloc::Ref_t Ref_t;
+	typedef typename Alloc::CRef_t CRef_t;
+	typedef typename Alloc::Ptr_t Ptr_t;
+	typedef typename Alloc::CPtr_t CPtr_t;
+	typedef ptrdiff_t Dif_t;
+	typedef size_t Size_t;
+
+	typedef KVector<Val_t, Alloc> Items_t;
+	typedef typename Items_t::Iter_t Iter_t;
+
+	// Half-open range of iterators.
+	typedef KPair<Iter_t, Iter_t> Range_t;
+
+	explicit KFlatTable()
+		: m_frozen(false)
+	{
+	}
+
+	~KFlatTable() {}
+
+	void Cleanup()
+	{
+		m_items.Cleanup();
+		m_index.Cleanup();
+		m_frozen = false;
+	}
+
+	Size_t GetSize() const
+	{
+		return m_items.GetSize();
+	}
+
+	bool IsEmpty() const
+	{
+		return GetSize() == 0;
+	}
+
+	bool IsFrozen() const
+	{
+		return m_frozen;
+	}
+
+	// Appends the item while the table is being built. Duplicate keys are dropped by Freeze().
+	__checkReturn_opt
+	bool Insert(__in CRef_t val)
+	{
+		ASSERT(!m_frozen);
+		if (m_frozen)
+			return false;
+
+		Size_t size = m_items.GetSize();
+		m_items.PushBack(val);
+
+		return m_items.GetSize() == size + 1;
+	}
+
+	// Sorts items by key and leaves single item of every key, which one is unspecified. Lookups are
+	// served by branchless binary search over the sorted array. Eytzinger layout additionally stores keys
+	// in breadth first order of the implicit search tree, so the first levels of every search share
+	// the same few cache lines. It costs a copy of every key and pays off for tables exceeding the cache.
+	__checkReturn
+	bool Freeze(__in bool eytzinger = false)
+	{
+		ASSERT(!m_frozen);
+
+		Size_t count = m_items.GetSize();
+		if (count)
+		{
+			// Items taken from another ordered container or produced by set algorithms need no sorting.
+			Ptr_t items = &m_items[0];
+			if (!IsSorted(items, count, ItemLess_t(m_less)))
+				HeapSort(items, count, ItemLess_t(m_less));
+
+			Size_t last = 0;
+			for (Size_t i = 1; i < count; i++)
+			{
+				if (m_less(KeyOf::Get(items[last]), KeyOf::Get(items[i])))
+				{
+					if (++last != i)
+						items[last] = items[i];
+				}
+			}
+
+			if (last + 1 < count)
+				m_items.Resize(last + 1);
+		}
+
+		if (eytzinger && !BuildIndex())
+			return false;
+
+		m_frozen = true;
+		return true;
+	}
+
+	Iter_t Begin()
+	{
+		return m_items.Begin();
+	}
+
+	Iter_t End()
+	{
+		return m_items.End();
+	}
+
+	__checkReturn
+	Iter_t Find(__in const Key_t& key)
+	{
+		Size_t index = Bound(key, false);
+		if ((index < GetSize()) && !m_less(key, KeyOf::Get(m_items[index])))
+			return GetIter(index);
+
+		return End();
+	}
+
+	__checkReturn
+	bool Contains(__in const Key_t& key)
+	{
+		return Find(key) != End();
+	}
+
+	// First item whose key is not less than given one.
+	__checkReturn
+	Iter_t LowerBound(__in const Key_t& key)
+	{
+		return GetIter(Bound(key, false));
+	}
+
+	// First item whose key is greater than given one.
+	__checkReturn
+	Iter_t UpperBound(__in const Key_t& key)
+	{
+		return GetIter(Bound(key, true));
+	}
+
+	// Keys are unique, so the range holds either a single item or none.
+	__checkReturn
+	Range_t EqualRange(__in const Key_t& key)
+	{
+		Size_t first = Bound(key, false);
+		Size_t last = first;
+		if ((first < GetSize()) && !m_less(key, KeyOf::Get(m_items[first])))
+			last++;
+
+		return Range_t(GetIter(first), GetIter(last));
+	}
+
+	// Calls the functor for every item with key in [first, last) in ascending order.
+	template <typename Func> void ForRange(__in const Key_t& first, __in const Key_t& last, __in Func& func)
+	{
+		for (Size_t i = Bound(first, false); (i < GetSize()) && m_less(KeyOf::Get(m_items[i]), last); i++)
+			func(m_items[i]);
+	}
+
+private:
+	typedef KPair<Key_t, Size_t> IndexEntry_t;
+	typedef KVector<IndexEntry_t, typename Alloc::template Rebind_t<IndexEntry_t>::Other_t> Index_t;
+
+	struct ItemLess_t
+	{
+		const Less& less;
+
+		ItemLess_t(const Less& comparator)
+			: less(comparator)
+		{
+		}
+
+		bool operator()(CRef_t x, CRef_t y) const
+		{
+			return less(KeyOf::Get(x), KeyOf::Get(y));
+		}
+	};
+
+private:
+	Iter_t GetIter(__in Size_t index)
+	{
+		Iter_t iterator = Begin();
+		iterator.Advance(index);
+		return iterator;
+	}
+
+	// Tells whether the bound lies to the right of the probe key.
+	bool IsBeyond(__in const Key_t& probe, __in const Key_t& key, __in bool upper) const
+	{
+		return (upper) ? !m_less(key, probe) : m_less(probe, key);
+	}
+
+	// Index of the first item whose key is not less or, when upper is set, greater than given one.
+	// Lookups are meaningful only once the table has been frozen.
+	Size_t Bound(__in const Key_t& key, __in bool upper)
+	{
+		ASSERT(m_frozen);
+
+		if (!m_index.IsEmpty())
+			return IndexBound(key, upper);
+
+		Size_t count = GetSize();
+		if (!count)
+			return 0;
+
+		// Only the base moves and the step does not depend on comparison results, so the compiler emits
+		// a conditional move rather than a branch and the loop runs log2(n) steps for any key.
+		Ptr_t items = &m_items[0];
+		Size_t base = 0;
+		while (count > 1)
+		{
+			Size_t half = count / 2;
+			base = IsBeyond(KeyOf::Get(items[base + half]), key, upper) ? base + half : base;
+			count -= half;
+		}
+
+		return base + (IsBeyond(KeyOf::Get(items[base]), key, upper) ? 1 : 0);
+	}
+
+	// Descends the implicit tree where children of slot k are 2k and 2k + 1. Right turns taken after
+	// the last left one are undone by the trailing set bits of the slot, then the slot of that left turn
+	// holds the bound. No left turn at all means every key is beyond.
+	Size_t IndexBound(__in const Key_t& key, __in bool upper)
+	{
+		Size_t count = GetSize();
+		Size_t slot = 1;
+		while (slot <= count)
+			slot = 2 * slot + (IsBeyond(m_index[slot].first, key, upper) ? 1 : 0);
+
+		while (slot & 1)
+			slot >>= 1;
+
+		slot >>= 1;
+
+		return (slot) ? m_index[slot].second : count;
+	}
+
+	__checkReturn
+	bool BuildIndex()
+	{
+		Size_t count = GetSize();
+		if (!count)
+			return true;
+
+		// Slot 0 is unused, so that the children of any slot are computed by a shift.
+		m_index.Resize(count + 1);
+		if (m_index.GetSize() != count + 1)
+		{
+			m_index.Cleanup();
+			return false;
+		}
+
+		FillIndex(0, 1);
+		return true;
+	}
+
+	// Walks the implicit tree in order, so slots receive items in ascending order. Recursion depth is log2(n).
+	Size_t FillIndex(__in Size_t rank, __in Size_t slot)
+	{
+		if (slot > GetSize())
+			return rank;
+
+		rank = FillIndex(rank, 2 * slot);
+
+		m_index[slot].first = KeyOf::Get(m_items[rank]);
+		m_index[slot].second = rank;
+
+		return FillIndex(rank + 1, 2 * slot + 1);
+	}
+
+protected:
+	Items_t m_items;
+	Index_t m_index;
+	Less m_less;
+	bool m_frozen;
+};
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "CommonDefinitions.h"
 #include "Synch.h"
 #include "Allocator.h"
+#include "Utility.h"
 
 template < typename T, typename Alloc > class KForwardList
 {
@@ -163,6 +164,28 @@ public:
 		Cleanup();
 	}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	// Splices the nodes in, the other list ends up empty.
+	KForwardList(KForwardList&& other)
+	{
+		m_anchor.Next = other.m_anchor.Next;
+		other.m_anchor.Next = NULL;
+	}
+
+	KForwardList& operator = (KForwardList&& other)
+	{
+		if (this != &other)
+		{
+			Cleanup();
+
+			m_anchor.Next = other.m_anchor.Next;
+			other.m_anchor.Next = NULL;
+		}
+
+		return *this;
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
 	Iter_t Begin()
 	{
 		Iter_t iterator(m_anchor.Next);
@@ -201,6 +224,14 @@ public:
 		PushEntryList(&m_anchor, &item->link);
 	}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	void Push(Val_t&& obj)
+	{
+		Item_t* item = Prepare(::Move(obj));
+		PushEntryList(&m_anchor, &item->link);
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
 	Val_t Pop()
 	{
 		PSINGLE_LIST_ENTRY entry = PopEntryList(&m_anchor);
@@ -245,11 +276,29 @@ private:
 		return item;
 	}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	ItemPtr_t Prepare(Val_t&& obj)
+	{
+		Size_t num = sizeof(Item_t);
+		ItemPtr_t item = m_allocator.Allocate(num);
+		ASSERT(item);
+
+		if (!item)
+			return NULL;
+
+		m_allocator.Construct(item);
+		item->object = ::Move(obj);
+
+		return item;
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
+	// Item is about to be freed, so its object is moved out rather than copied.
 	Val_t Delete(PSINGLE_LIST_ENTRY entry)
 	{
 		ASSERT(entry);
 		ItemPtr_t item = CONTAINING_RECORD(entry, Item_t, link);
-		Val_t val = item->object;
+		Val_t val(::Move(item->object));
 		m_allocator.Destroy(item);
 		m_allocator.Deallocate(item);
 
@@ -22,6 +22,16 @@ struct BinaryFunction
 	typedef Result Result_t;
 };
 
+// Default ordering policy of ordered containers.
+template <typename T>
+struct KLess : public BinaryFunction<T, T, bool>
+{
+	bool operator()(const T& x, const T& y) const
+	{
+		return x < y;
+	}
+};
+
 template <typename Tp, bool> struct MemFnConstOrNon
 {
 	typedef const Tp& type;
@@ -0,0 +1,289 @@
+#pragma once
+
+#include "Map.h"
+
+// Map of disjoint half-open ranges [start, end) to values, e.g. dirty, locked or cached byte ranges of a file.
+// Ranges are kept in an AVL map keyed by their end, so the first range overlapping [start, end) is the first one
+// ending after start and the rest follow in order, thus overlap queries cost O(log n + k).
+// Assigning a value to a range splits the ranges it cuts and coalesces the result with adjacent or overlapping
+// ranges holding an equal value, so the map always holds the fewest ranges possible.
+template <typename Offset, typename T, typename Lock, typename Alloc> class KIntervalMap
+{
+	CLASS_NO_COPY(KIntervalMap)
+public:
+	typedef Offset Offset_t;
+	typedef T Mapped_t;
+	typedef size_t Size_t;
+
+	struct Segment_t
+	{
+		Offset_t start;
+		Mapped_t value;
+
+		Segment_t()
+			: start()
+			, value()
+		{
+		}
+
+		Segment_t(const Offset_t& first, const Mapped_t& val)
+			: start(first)
+			, value(val)
+		{
+		}
+	};
+
+	explicit KIntervalMap() {}
+	~KIntervalMap() {}
+
+	// Assigns the value to every offset of [start, end). Returns false if a node could not be allocated,
+	// the map is left intact then.
+	__checkReturn_opt
+	bool Assign(__in const Offset_t& start, __in const Offset_t& end, __in const Mapped_t& val)
+	{
+		ASSERT(start < end);
+
+		KExclusiveLocker<Lock> locker(m_lock);
+		return LockedAssign(start, end, &val);
+	}
+
+	// Removes every offset of [start, end) from the map. Cutting a range in the middle takes a node,
+	// so erasure may fail as well.
+	__checkReturn_opt
+	bool Erase(__in const Offset_t& start, __in const Offset_t& end)
+	{
+		ASSERT(start < end);
+
+		KExclusiveLocker<Lock> locker(m_lock);
+		return LockedAssign(start, end, NULL);
+	}
+
+	// Looks up the range covering the offset.
+	__checkReturn
+	bool Find(__in const Offset_t& offset, __out_opt Mapped_t* val = NULL, __out_opt Offset_t* start = NULL, __out_opt Offset_t* end = NULL)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		Iter_t it = m_map.UpperBound(offset);
+		if ((it == m_map.End()) || (offset < it->second.start))
+			return false;
+
+		if (val)
+			*val = it->second.value;
+
+		if (start)
+			*start = it->second.start;
+
+		if (end)
+			*end = it->first;
+
+		return true;
+	}
+
+	__checkReturn
+	bool Overlaps(__in const Offset_t& start, __in const Offset_t& end)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		Iter_t it = m_map.UpperBound(start);
+		return (it != m_map.End()) && (it->second.start < end);
+	}
+
+	// Calls the functor as func(start, end, value) for every range overlapping [start, end) in ascending order
+	// within a single lock acquisition. Ranges are passed whole rather than clipped to the query.
+	// The functor must not call back into the map.
+	template <typename Func> void ForOverlaps(__in const Offset_t& start, __in const Offset_t& end, __in Func& func)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		for (Iter_t it = m_map.UpperBound(start); (it != m_map.End()) && (it->second.start < end); ++it)
+			func(it->second.start, it->first, it->second.value);
+	}
+
+	// Number of disjoint ranges after coalescing.
+	Size_t GetCount()
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		return m_map.GetSize();
+	}
+
+	bool IsEmpty()
+	{
+		return GetCount() == 0;
+	}
+
+	void Cleanup()
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		m_map.Cleanup();
+	}
+
+	Lock& GetLock()
+	{
+		return m_lock;
+	}
+
+private:
+	// Guarded by m_lock, hence KNullLock.
+	typedef KPair<Offset_t, Segment_t> Node_t;
+	typedef KPoolMap< Offset_t, Segment_t, KNullLock, typename Alloc::template Rebind_t<Node_t>::Other_t > Map_t;
+	typedef typename Map_t::Iter_t Iter_t;
+	typedef typename Map_t::InsertResult_t InsertResult_t;
+
+private:
+	// Caller must hold the lock exclusively. NULL value erases the range. Nodes are allocated before anything
+	// is changed: the left remainder of a cut range gets a node of its own keyed by start, the range being
+	// assigned takes the node of the range ending where it ends or a new one. The right remainder of a cut range
+	// keeps its node, since it keeps its end. Only then the ranges covered are erased.
+	__checkReturn
+	bool LockedAssign(__in Offset_t start, __in Offset_t end, __in_opt const Mapped_t* val)
+	{
+		const Offset_t first = start;
+		const Offset_t last = end;
+
+		// Range ending right at the start is coalesced if it holds the same value.
+		bool mergeLeft = false;
+		if (val)
+		{
+			Iter_t left = m_map.Find(first);
+			if ((left != m_map.End()) && (left->second.value == *val))
+			{
+				mergeLeft = true;
+				start = left->second.start;
+			}
+		}
+
+		// Walk the ranges overlapping [first, last) and the one starting right at the end.
+		bool cutLeft = false;
+		Segment_t leftRest;
+		Offset_t rightRestEnd = Offset_t();
+		bool cutRight = false;
+		bool any = false;
+		Offset_t lastCovered = Offset_t();
+
+		for (Iter_t it = m_map.UpperBound(first); it != m_map.End(); ++it)
+		{
+			const Segment_t& segment = it->second;
+			bool same = val && (segment.value == *val);
+
+			if (last < segment.start)
+				break;
+
+			if (!(segment.start < last))
+			{
+				// Adjacent range starting at the end is covered only if it is coalesced.
+				if (same)
+				{
+					end = it->first;
+					any = true;
+					lastCovered = it->first;
+				}
+
+				break;
+			}
+
+			if (segment.start < first)
+			{
+				if (same)
+				{
+					start = segment.start;
+				}
+				else
+				{
+					cutLeft = true;
+					leftRest = segment;
+				}
+			}
+
+			if (last < it->first)
+			{
+				if (same)
+				{
+					end = it->first;
+				}
+				else
+				{
+					cutRight = true;
+					rightRestEnd = it->first;
+					break;
+				}
+			}
+
+			any = true;
+			lastCovered = it->first;
+		}
+
+		if (!val && !any && !cutLeft && !cutRight)
+			return true;
+
+		if (cutLeft)
+		{
+			InsertResult_t res = m_map.TryEmplace(first, leftRest);
+			if (!res.first)
+				return false;
+		}
+
+		if (val)
+		{
+			InsertResult_t res = m_map.TryEmplace(end);
+			if (!res.first)
+			{
+				if (cutLeft)
+					m_map.Erase(first);
+
+				return false;
+			}
+
+			res.first->second = Segment_t(start, *val);
+		}
+
+		if (cutRight)
+		{
+			Iter_t right = m_map.Find(rightRestEnd);
+			right->second.start = last;
+		}
+
+		if (mergeLeft)
+			m_map.Erase(first);
+
+		// Covered ranges end within (first, lastCovered], except the one reused for the new range.
+		if (any)
+		{
+			Offset_t cursor = first;
+			for (;;)
+			{
+				Iter_t it = m_map.UpperBound(cursor);
+				if ((it == m_map.End()) || (lastCovered < it->first))
+					break;
+
+				cursor = it->first;
+				if (!val || !(cursor == end))
+					m_map.Erase(cursor);
+			}
+		}
+
+		return true;
+	}
+
+private:
+	Lock m_lock;
+	Map_t m_map;
+};
+
+// Lookaside flavours are not offered, since the inner map node differs in size from KPair<K, T>.
+template <typename K, typename T> struct KPagedPoolIntervalMap
+{
+	typedef KIntervalMap< K, T, KGuardedMutex, typename KPagedPoolAllocator< KPair<K, T> >::Type > Type;
+};
+
+template <typename K, typename T> struct KNonPagedPoolIntervalMap
+{
+	typedef KIntervalMap< K, T, KSpinLock, typename KNonPagedPoolAllocator< KPair<K, T> >::Type > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KTaggedPagedPoolIntervalMap
+{
+	typedef KIntervalMap< K, T, KGuardedMutex, typename KTaggedPagedPoolAllocator< KPair<K, T>, Tag >::Type > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KTaggedNonPagedPoolIntervalMap
+{
+	typedef KIntervalMap< K, T, KSpinLock, typename KTaggedNonPagedPoolAllocator< KPair<K, T>, Tag >::Type > Type;
+};
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "CommonDefinitions.h"
 #include "Allocator.h"
+#include "Utility.h"
 
 template < typename T, typename Alloc > class KList
 {
@@ -221,6 +222,26 @@ public:
 		Cleanup();
 	}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	// Other list is left empty.
+	KList(KList&& other)
+	{
+		InitializeListHead(&m_anchor);
+		TakeOver(other);
+	}
+
+	KList& operator = (KList&& other)
+	{
+		if (this != &other)
+		{
+			Cleanup();
+			TakeOver(other);
+		}
+
+		return *this;
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
 	Iter_t Begin()
 	{
 		Iter_t iterator(&m_anchor, m_anchor.Flink);
@@ -289,6 +310,32 @@ public:
 		InsertTailList(it.m_current, &item->link);
 	}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	void InsertFirst(Val_t&& obj)
+	{
+		Item_t* item = Prepare(::Move(obj));
+		InsertHeadList(&m_anchor, &item->link);
+	}
+
+	void InsertLast(Val_t&& obj)
+	{
+		Item_t* item = Prepare(::Move(obj));
+		InsertTailList(&m_anchor, &item->link);
+	}
+
+	void InsertBefore(const Iter_t& it, Val_t&& obj)
+	{
+		Item_t* item = Prepare(::Move(obj));
+		InsertHeadList(it.m_current, &item->link);
+	}
+
+	void InsertAfter(const Iter_t& it, Val_t&& obj)
+	{
+		Item_t* item = Prepare(::Move(obj));
+		InsertTailList(it.m_current, &item->link);
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
 	Val_t RemoveFirst()
 	{
 		PLIST_ENTRY entry = RemoveHeadList(&m_anchor);
@@ -348,11 +395,41 @@ private:
 		return item;
 	}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	ItemPtr_t Prepare(Val_t&& obj)
+	{
+		Size_t num = sizeof(Item_t);
+		ItemPtr_t item = m_allocator.Allocate(num);
+		ASSERT(item);
+
+		if (!item)
+			return NULL;
+
+		m_allocator.Construct(item);
+		item->object = ::Move(obj);
+
+		return item;
+	}
+
+	void TakeOver(KList& other)
+	{
+		if (other.IsEmpty())
+			return;
+
+		m_anchor = other.m_anchor;
+		m_anchor.Flink->Blink = &m_anchor;
+		m_anchor.Blink->Flink = &m_anchor;
+
+		InitializeListHead(&other.m_anchor);
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
+	// Item is about to be freed, so its object is moved out rather than copied.
 	Val_t RemoveAt(PLIST_ENTRY entry)
 	{
 		ASSERT(entry);
 		ItemPtr_t item = CONTAINING_RECORD(entry, Item_t, link);
-		Val_t val = item->object;
+		Val_t val(::Move(item->object));
 		m_allocator.Destroy(item);
 		m_allocator.Deallocate(item);
 
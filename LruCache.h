@@ -0,0 +1,482 @@
+#pragma once
+
+#include "CommonDefinitions.h"
+#include "Synch.h"
+#include "Allocator.h"
+#include "Utility.h"
+
+// Cache of bounded size with O(1) lookup, insertion and removal. Items are indexed by a hash table
+// and ordered by recency in a doubly linked list, so the victim is always at the tail of the list.
+//
+// LRU policy moves every hit to the head of the list, hence Get() takes the lock exclusively.
+// CLOCK policy gives a hit item the second chance instead: Get() sets its referenced flag under
+// the shared lock and eviction moves flagged items back to the head clearing the flag. Shared hits
+// pay off with reader-writer locks such as KResource.
+//
+// Items dropped from the cache for whatever reason, i.e. evicted, expired, erased, replaced by Put()
+// or cleaned up, are handed to the evict routine after the lock has been released, so the routine
+// may block or call back into the cache. The allocator must serve requests of arbitrary size
+// since the bucket array is allocated through it.
+template
+<
+	typename Key,
+	typename T,
+	typename Lock,
+	typename Alloc,
+	typename Hash = KHash<Key>
+> class KLruCache
+{
+	CLASS_NO_COPY(KLruCache)
+public:
+	typedef Key Key_t;
+	typedef T Mapped_t;
+	typedef size_t Size_t;
+
+	enum Policy_t
+	{
+		LruPolicy,
+		ClockPolicy
+	};
+
+	typedef VOID (*EvictRoutine_t)(__in const Key_t& key, __in Mapped_t& value, __in_opt PVOID context);
+
+	struct Statistics_t
+	{
+		LONGLONG hits;
+		LONGLONG misses;
+		LONGLONG evictions;
+		Size_t count;
+		Size_t charge;
+	};
+
+	struct Entry_t
+	{
+		LIST_ENTRY link;
+		Entry_t* next;
+		ULONG hash;
+		volatile LONG referenced;
+		ULONGLONG expires;
+		Size_t charge;
+		Key_t key;
+		Mapped_t value;
+
+		Entry_t()
+			: next(NULL)
+			, hash(0)
+			, referenced(0)
+			, expires(0)
+			, charge(0)
+			, key()
+			, value()
+		{
+			InitializeListHead(&link);
+		}
+
+		~Entry_t() {}
+	};
+
+	typedef Entry_t* EntryPtr_t;
+
+	explicit KLruCache(__in Size_t maxEntries, __in Policy_t policy = LruPolicy)
+		: m_policy(policy)
+		, m_maxEntries(maxEntries)
+		, m_maxCharge(0)
+		, m_timeToLive(0)
+		, m_evictRoutine(NULL)
+		, m_evictContext(NULL)
+		, m_buckets(NULL)
+		, m_bucketCount(0)
+		, m_count(0)
+		, m_charge(0)
+		, m_hits(0)
+		, m_misses(0)
+		, m_evictions(0)
+	{
+		ASSERT(maxEntries);
+		InitializeListHead(&m_list);
+	}
+
+	~KLruCache()
+	{
+		Cleanup();
+	}
+
+	// Zero charge limit means that only the number of entries is limited. Every entry is charged with its own
+	// size plus the charge given to Put(). The most recent entry stays even if it alone exceeds the budget.
+	void SetBudget(__in Size_t maxEntries, __in Size_t maxCharge)
+	{
+		ASSERT(maxEntries);
+
+		LIST_ENTRY victims;
+		InitializeListHead(&victims);
+		{
+			KExclusiveLocker<Lock> locker(m_lock);
+			m_maxEntries = maxEntries;
+			m_maxCharge = maxCharge;
+			Trim(&victims);
+		}
+
+		Dispose(&victims);
+	}
+
+	// Default time to live in 100 ns units applied to entries put without their own one. Zero means forever.
+	void SetTimeToLive(__in ULONGLONG timeToLive)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		m_timeToLive = timeToLive;
+	}
+
+	// Must be set before the cache is shared, since the routine is called without the lock.
+	void SetEvictRoutine(__in_opt EvictRoutine_t routine, __in_opt PVOID context)
+	{
+		m_evictRoutine = routine;
+		m_evictContext = context;
+	}
+
+	// The value is copied out under the lock since the entry may be dropped as soon as the lock is released.
+	__checkReturn
+	bool Get(__in const Key_t& key, __out_opt Mapped_t* val = NULL)
+	{
+		if (m_policy == ClockPolicy)
+			return ClockGet(key, val);
+		else
+			return LruGet(key, val);
+	}
+
+	// Inserts the item or replaces the existing one with the same key. Entry is allocated before the lock
+	// is taken to keep the lock hold time short. Time to live of zero stands for the default one.
+	__checkReturn_opt
+	bool Put(__in const Key_t& key, __in const Mapped_t& val, __in Size_t charge = 0, __in ULONGLONG timeToLive = 0)
+	{
+		EntryPtr_t entry = m_entryAllocator.Allocate(sizeof(Entry_t));
+		ASSERT(entry);
+
+		if (!entry)
+			return false;
+
+		m_entryAllocator.Construct(entry);
+		entry->key = key;
+		entry->value = val;
+		entry->hash = m_hash(key);
+		entry->charge = sizeof(Entry_t) + charge;
+
+		LIST_ENTRY victims;
+		InitializeListHead(&victims);
+		bool res = false;
+		{
+			KExclusiveLocker<Lock> locker(m_lock);
+
+			ULONGLONG ttl = (timeToLive) ? timeToLive : m_timeToLive;
+			entry->expires = (ttl) ? KeQueryInterruptTime() + ttl : 0;
+
+			if (m_count >= m_bucketCount)
+				Rehash();
+
+			// Bucket array allocation might have failed for the very first entry.
+			if (m_buckets)
+			{
+				EntryPtr_t old = Lookup(key, entry->hash);
+				if (old)
+					Unlink(old, &victims);
+
+				Link(entry);
+				Trim(&victims);
+				res = true;
+			}
+		}
+
+		if (!res)
+			Free(entry);
+
+		Dispose(&victims);
+		return res;
+	}
+
+	__checkReturn_opt
+	bool Erase(__in const Key_t& key)
+	{
+		LIST_ENTRY victims;
+		InitializeListHead(&victims);
+		{
+			KExclusiveLocker<Lock> locker(m_lock);
+			EntryPtr_t entry = Lookup(key, m_hash(key));
+			if (!entry)
+				return false;
+
+			Unlink(entry, &victims);
+		}
+
+		Dispose(&victims);
+		return true;
+	}
+
+	void Cleanup()
+	{
+		LIST_ENTRY victims;
+		InitializeListHead(&victims);
+		{
+			KExclusiveLocker<Lock> locker(m_lock);
+			while (!IsListEmpty(&m_list))
+				Unlink(CONTAINING_RECORD(m_list.Flink, Entry_t, link), &victims);
+
+			if (m_buckets)
+				m_bucketAllocator.Deallocate(m_buckets);
+
+			m_buckets = NULL;
+			m_bucketCount = 0;
+		}
+
+		Dispose(&victims);
+	}
+
+	void GetStatistics(__out Statistics_t* stats)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		stats->hits = m_hits;
+		stats->misses = m_misses;
+		stats->evictions = m_evictions;
+		stats->count = m_count;
+		stats->charge = m_charge;
+	}
+
+	Size_t GetCount()
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		return m_count;
+	}
+
+	Lock& GetLock()
+	{
+		return m_lock;
+	}
+
+private:
+	typedef typename Alloc::template Rebind_t<Entry_t>::Other_t EntryAlloc_t;
+	typedef typename Alloc::template Rebind_t<EntryPtr_t>::Other_t BucketAlloc_t;
+
+	static const ULONG s_initialBucketCount = 16;
+
+private:
+	bool LruGet(__in const Key_t& key, __out_opt Mapped_t* val)
+	{
+		LIST_ENTRY victims;
+		InitializeListHead(&victims);
+		bool res = false;
+		{
+			KExclusiveLocker<Lock> locker(m_lock);
+			EntryPtr_t entry = Lookup(key, m_hash(key));
+			if (entry && IsExpired(entry, KeQueryInterruptTime()))
+			{
+				Unlink(entry, &victims);
+				m_evictions++;
+				entry = NULL;
+			}
+
+			if (entry)
+			{
+				RemoveEntryList(&entry->link);
+				InsertHeadList(&m_list, &entry->link);
+
+				if (val)
+					*val = entry->value;
+
+				m_hits++;
+				res = true;
+			}
+			else
+			{
+				m_misses++;
+			}
+		}
+
+		Dispose(&victims);
+		return res;
+	}
+
+	// Expired entry is left in place since the shared lock does not allow to unlink it. Eviction drops it
+	// before any other one as soon as it reaches the tail.
+	bool ClockGet(__in const Key_t& key, __out_opt Mapped_t* val)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		EntryPtr_t entry = Lookup(key, m_hash(key));
+		if (!entry || IsExpired(entry, KeQueryInterruptTime()))
+		{
+			InterlockedIncrement64(&m_misses);
+			return false;
+		}
+
+		// Flag is tested first, so hot entries do not bounce the cache line between processors.
+		if (!entry->referenced)
+			InterlockedExchange(&entry->referenced, 1);
+
+		if (val)
+			*val = entry->value;
+
+		InterlockedIncrement64(&m_hits);
+		return true;
+	}
+
+	// Caller must hold the lock exclusively. Evicts from the tail until the cache fits the budget.
+	// Under CLOCK policy referenced entries get the second chance, so every entry is passed twice at most.
+	void Trim(__inout PLIST_ENTRY victims)
+	{
+		ULONGLONG now = KeQueryInterruptTime();
+		while ((m_count > 1) && ((m_count > m_maxEntries) || (m_maxCharge && (m_charge > m_maxCharge))))
+		{
+			EntryPtr_t entry = CONTAINING_RECORD(m_list.Blink, Entry_t, link);
+			if ((m_policy == ClockPolicy) && entry->referenced && !IsExpired(entry, now))
+			{
+				entry->referenced = 0;
+				RemoveEntryList(&entry->link);
+				InsertHeadList(&m_list, &entry->link);
+				continue;
+			}
+
+			Unlink(entry, victims);
+			m_evictions++;
+		}
+	}
+
+	static bool IsExpired(__in EntryPtr_t entry, __in ULONGLONG now)
+	{
+		return entry->expires && (now >= entry->expires);
+	}
+
+	ULONG GetBucketIndex(__in ULONG hash) const
+	{
+		return hash & (m_bucketCount - 1);
+	}
+
+	__checkReturn
+	EntryPtr_t Lookup(__in const Key_t& key, __in ULONG hash)
+	{
+		if (!m_buckets)
+			return NULL;
+
+		for (EntryPtr_t entry = m_buckets[GetBucketIndex(hash)]; entry; entry = entry->next)
+		{
+			if ((entry->hash == hash) && (entry->key == key))
+				return entry;
+		}
+
+		return NULL;
+	}
+
+	void Link(__in EntryPtr_t entry)
+	{
+		EntryPtr_t& head = m_buckets[GetBucketIndex(entry->hash)];
+		entry->next = head;
+		head = entry;
+
+		InsertHeadList(&m_list, &entry->link);
+		m_count++;
+		m_charge += entry->charge;
+	}
+
+	// Moves the entry from the cache to the list of victims to be disposed of once the lock is released.
+	void Unlink(__in EntryPtr_t entry, __inout PLIST_ENTRY victims)
+	{
+		for (EntryPtr_t* link = &m_buckets[GetBucketIndex(entry->hash)]; *link; link = &(*link)->next)
+		{
+			if (*link == entry)
+			{
+				*link = entry->next;
+				break;
+			}
+		}
+
+		RemoveEntryList(&entry->link);
+		InsertTailList(victims, &entry->link);
+		m_count--;
+		m_charge -= entry->charge;
+	}
+
+	// Called without the lock.
+	void Dispose(__inout PLIST_ENTRY victims)
+	{
+		while (!IsListEmpty(victims))
+		{
+			EntryPtr_t entry = CONTAINING_RECORD(RemoveHeadList(victims), Entry_t, link);
+			if (m_evictRoutine)
+				m_evictRoutine(entry->key, entry->value, m_evictContext);
+
+			Free(entry);
+		}
+	}
+
+	void Free(__in EntryPtr_t entry)
+	{
+		m_entryAllocator.Destroy(entry);
+		m_entryAllocator.Deallocate(entry);
+	}
+
+	// Doubles the bucket array. On allocation failure the cache keeps working at a higher load factor.
+	void Rehash()
+	{
+		ULONG newCount = (m_bucketCount) ? (m_bucketCount << 1) : s_initialBucketCount;
+		EntryPtr_t* newBuckets = m_bucketAllocator.Allocate(newCount * sizeof(EntryPtr_t));
+		if (!newBuckets)
+			return;
+
+		RtlZeroMemory(newBuckets, newCount * sizeof(EntryPtr_t));
+
+		for (ULONG i = 0; i < m_bucketCount; i++)
+		{
+			EntryPtr_t entry = m_buckets[i];
+			while (entry)
+			{
+				EntryPtr_t next = entry->next;
+				EntryPtr_t& head = newBuckets[entry->hash & (newCount - 1)];
+				entry->next = head;
+				head = entry;
+				entry = next;
+			}
+		}
+
+		if (m_buckets)
+			m_bucketAllocator.Deallocate(m_buckets);
+
+		m_buckets = newBuckets;
+		m_bucketCount = newCount;
+	}
+
+private:
+	Lock m_lock;
+	Policy_t m_policy;
+	Size_t m_maxEntries;
+	Size_t m_maxCharge;
+	ULONGLONG m_timeToLive;
+	EvictRoutine_t m_evictRoutine;
+	PVOID m_evictContext;
+	EntryAlloc_t m_entryAllocator;
+	BucketAlloc_t m_bucketAllocator;
+	EntryPtr_t* m_buckets;
+	ULONG m_bucketCount;
+	LIST_ENTRY m_list;
+	Size_t m_count;
+	Size_t m_charge;
+	volatile LONGLONG m_hits;
+	volatile LONGLONG m_misses;
+	volatile LONGLONG m_evictions;
+	Hash m_hash;
+};
+
+template <typename K, typename T> struct KPagedPoolLruCache
+{
+	typedef KLruCache< K, T, KGuardedMutex, typename KPagedPoolAllocator< KPair<K, T> >::Type > Type;
+};
+
+template <typename K, typename T> struct KNonPagedPoolLruCache
+{
+	typedef KLruCache< K, T, KSpinLock, typename KNonPagedPoolAllocator< KPair<K, T> >::Type > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KTaggedPagedPoolLruCache
+{
+	typedef KLruCache< K, T, KGuardedMutex, typename KTaggedPagedPoolAllocator< KPair<K, T>, Tag >::Type > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KTaggedNonPagedPoolLruCache
+{
+	typedef KLruCache< K, T, KSpinLock, typename KTaggedNonPagedPoolAllocator< KPair<K, T>, Tag >::Type > Type;
+};
\ No newline at end of file
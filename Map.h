@@ -1,14 +1,23 @@
 #pragma once
 
 #include "AvlTree.h"
+#include "NativeAvlTree.h"
 #include "Utility.h"
 
-template <typename ConcreteMap, typename Key, typename T, typename Lock, typename Alloc> class KMap
-: public KAvlTree< ConcreteMap, Lock, Alloc >
+// Tree is the engine storing items, either KAvlTree built on RTL_AVL_TABLE or KNativeAvlTree.
+template
+<
+	typename ConcreteMap,
+	typename Key,
+	typename T,
+	typename Lock,
+	typename Alloc,
+	typename Tree = KAvlTree< ConcreteMap, Lock, Alloc, KSelectFirstKey<typename Alloc::Val_t> >
+> class KMap : public Tree
 {
 	CLASS_NO_COPY(KMap)
 
-	typedef KAvlTree< ConcreteMap, Lock, Alloc > Base_t;
+	typedef Tree Base_t;
 public:
 	typedef Key Key_t;
 	typedef T Mapped_t;
@@ -16,53 +25,74 @@ public:
 	explicit KMap() {}
 	~KMap() {}
 
+	// Inserts the key with given mapped value unless the key is present already. Existing item is left untouched.
 	__checkReturn_opt
-	bool Erase(__in const Key_t& key)
+	__drv_mustHold(Lock)
+	InsertResult_t TryEmplace(__in const Key_t& key, __in const Mapped_t& mapped)
 	{
-		Val_t val(key, Mapped_t());
-		return Base_t::Erase(val);
+		KExclusiveLocker<Lock> locker(m_lock);
+		PVOID nodeOrParent = NULL;
+		TABLE_SEARCH_RESULT searchResult = TableEmptyTree;
+
+		Ptr_t item = LockedLookup(key, &nodeOrParent, &searchResult);
+		if (item)
+			return InsertResult_t(item, false);
+
+		Val_t val(key, mapped);
+		return LockedInsertAt(::Move(val), nodeOrParent, searchResult);
 	}
 
-	__checkReturn
-	Iter_t Find(__in const Key_t& key)
+	// Same as above yet the mapped value is default constructed only when the key is absent.
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	InsertResult_t TryEmplace(__in const Key_t& key)
 	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		PVOID nodeOrParent = NULL;
+		TABLE_SEARCH_RESULT searchResult = TableEmptyTree;
+
+		Ptr_t item = LockedLookup(key, &nodeOrParent, &searchResult);
+		if (item)
+			return InsertResult_t(item, false);
+
 		Val_t val(key, Mapped_t());
-		return Base_t::Find(val);
+		return LockedInsertAt(::Move(val), nodeOrParent, searchResult);
 	}
 
+	// Inserts the key or overwrites mapped value of the existing item.
 	__checkReturn_opt
 	__drv_mustHold(Lock)
-	Mapped_t& operator[] (__in const Key_t& key)
+	InsertResult_t InsertOrAssign(__in const Key_t& key, __in const Mapped_t& mapped)
 	{
-		Val_t val(key, Mapped_t());
+		Val_t val(key, mapped);
 
-		m_lock.Lock();
-		Ptr_t item = Lookup(val);
-		if (item)
-		{
-			m_lock.Unlock();
-			return item->second;
-		}
+		KExclusiveLocker<Lock> locker(m_lock);
+		InsertResult_t res = LockedFindOrInsert(::Move(val));
+		if (res.first && !res.second)
+			res.first->second = mapped;
+
+		return res;
+	}
+
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	Mapped_t& operator[] (__in const Key_t& key)
+	{
+		InsertResult_t res = TryEmplace(key);
+		if (res.first)
+			return res.first->second;
 		else
-		{
-			m_lock.Unlock();
-
-			Ptr_t res = NULL;
-			if (Insert(val, &res))
-				return res->second;
-			else
-				return m_nullObj.second;
-		}
+			return m_nullObj.second;
 	}
 
 protected:
 	__checkReturn
-	RTL_GENERIC_COMPARE_RESULTS OnCompare(__in CRef_t x, __in CRef_t y) const
+	RTL_GENERIC_COMPARE_RESULTS OnCompare(__in const Key_t& x, __in const Key_t& y) const
 	{
-		if (x.first == y.first)
+		if (x == y)
 			return GenericEqual;
 
-		if (x.first < y.first)
+		if (x < y)
 			return GenericLessThan; 
 		else
 			return GenericGreaterThan;
@@ -78,7 +108,7 @@ template <typename Key, typename T, typename Lock, typename Alloc> class KPoolMa
 {
 	CLASS_NO_COPY(KPoolMap)
 
-	friend class KAvlTree< KPoolMap<Key, T, Lock, Alloc>, Lock, Alloc >;
+	friend class KAvlTree< KPoolMap<Key, T, Lock, Alloc>, Lock, Alloc, KSelectFirstKey<typename Alloc::Val_t> >;
 public:
 	explicit KPoolMap() : KAvlTreePoolEventSink(m_allocator)
 	{}
@@ -98,7 +128,7 @@ template <typename Key, typename T, typename Lock, typename Alloc> class KLookas
 {
 	CLASS_NO_COPY(KLookasideMap)
 
-	friend class KAvlTree< KLookasideMap<Key, T, Lock, Alloc>, Lock, Alloc >;
+	friend class KAvlTree< KLookasideMap<Key, T, Lock, Alloc>, Lock, Alloc, KSelectFirstKey<typename Alloc::Val_t> >;
 public:
 	explicit KLookasideMap()
 	{
@@ -117,6 +147,22 @@ private:
 	ItemAlloc_t m_allocator;
 };
 
+// Map on KNativeAvlTree. The tree allocates and frees nodes itself, so no event sink is needed.
+template <typename Key, typename T, typename Lock, typename Alloc> class KNativeMap
+: public KMap
+<
+	KNativeMap<Key, T, Lock, Alloc>, Key, T, Lock, Alloc,
+	KNativeAvlTree< KNativeMap<Key, T, Lock, Alloc>, Lock, Alloc, KSelectFirstKey<typename Alloc::Val_t> >
+>
+{
+	CLASS_NO_COPY(KNativeMap)
+
+	friend class KNativeAvlTree< KNativeMap<Key, T, Lock, Alloc>, Lock, Alloc, KSelectFirstKey<typename Alloc::Val_t> >;
+public:
+	explicit KNativeMap() {}
+	~KNativeMap() {}
+};
+
 template <typename K, typename T> struct KPagedPoolMap
 {
 	typedef KPoolMap< K, T, KGuardedMutex, typename KPagedPoolAllocator< KPair<K, T> >::Type > Type;
@@ -145,4 +191,34 @@ template <typename K, typename T, ULONG Tag> struct KPagedLookasideMap
 template <typename K, typename T, ULONG Tag> struct KNonPagedLookasideMap
 {
 	typedef KLookasideMap< K, T, KSpinLock, KNonPagedLookasideAllocator< KPair<K, T>, Tag > > Type;
+};
+
+template <typename K, typename T> struct KPagedPoolNativeMap
+{
+	typedef KNativeMap< K, T, KGuardedMutex, typename KPagedPoolAllocator< KPair<K, T> >::Type > Type;
+};
+
+template <typename K, typename T> struct KNonPagedPoolNativeMap
+{
+	typedef KNativeMap< K, T, KSpinLock, typename KNonPagedPoolAllocator< KPair<K, T> >::Type > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KTaggedPagedPoolNativeMap
+{
+	typedef KNativeMap< K, T, KGuardedMutex, typename KTaggedPagedPoolAllocator< KPair<K, T>, Tag >::Type > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KTaggedNonPagedPoolNativeMap
+{
+	typedef KNativeMap< K, T, KSpinLock, typename KTaggedNonPagedPoolAllocator< KPair<K, T>, Tag >::Type > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KPagedLookasideNativeMap
+{
+	typedef KNativeMap< K, T, KGuardedMutex, KPagedLookasideAllocator< KPair<K, T>, Tag > > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KNonPagedLookasideNativeMap
+{
+	typedef KNativeMap< K, T, KSpinLock, KNonPagedLookasideAllocator< KPair<K, T>, Tag > > Type;
 };
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "MultiTable.h"
+
+// Ordered map allowing duplicate keys. Values of a key are kept in insertion order.
+template <typename Key, typename T, typename Lock, typename Alloc> class KMultiMap : public KMultiTable<Key, T, Lock, Alloc>
+{
+	CLASS_NO_COPY(KMultiMap)
+public:
+	typedef T Mapped_t;
+
+	explicit KMultiMap() {}
+	~KMultiMap() {}
+
+	// Appends the value after the values already mapped to the key.
+	__checkReturn_opt
+	bool Insert(__in const Key& key, __in const Mapped_t& val)
+	{
+		return this->InsertItem(key, val);
+	}
+
+	// Erases the earliest inserted value of the key equal to given one.
+	__checkReturn_opt
+	bool Erase(__in const Key& key, __in const Mapped_t& val)
+	{
+		EqualTo_t pred(val);
+		return this->EraseFirst(key, pred);
+	}
+
+private:
+	struct EqualTo_t
+	{
+		const Mapped_t& val;
+
+		explicit EqualTo_t(const Mapped_t& other)
+			: val(other)
+		{
+		}
+
+		bool operator()(const Mapped_t& item) const
+		{
+			return item == val;
+		}
+	};
+};
+
+// Lookaside flavours are not offered, since chunks of values vary in size.
+template <typename K, typename T> struct KPagedPoolMultiMap
+{
+	typedef KMultiMap< K, T, KGuardedMutex, typename KPagedPoolAllocator< KPair<K, T> >::Type > Type;
+};
+
+template <typename K, typename T> struct KNonPagedPoolMultiMap
+{
+	typedef KMultiMap< K, T, KSpinLock, typename KNonPagedPoolAllocator< KPair<K, T> >::Type > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KTaggedPagedPoolMultiMap
+{
+	typedef KMultiMap< K, T, KGuardedMutex, typename KTaggedPagedPoolAllocator< KPair<K, T>, Tag >::Type > Type;
+};
+
+template <typename K, typename T, ULONG Tag> struct KTaggedNonPagedPoolMultiMap
+{
+	typedef KMultiMap< K, T, KSpinLock, typename KTaggedNonPagedPoolAllocator< KPair<K, T>, Tag >::Type > Type;
+};
\ No newline at end of file
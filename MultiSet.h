@@ -0,0 +1,57 @@
+#pragma once
+
+#include "MultiTable.h"
+
+// Ordered set allowing equal items. Items comparing equal are kept in insertion order, so the set also
+// serves as a stable ordering of items by a key part of them, given the comparison looks at that part only.
+template <typename T, typename Lock, typename Alloc> class KMultiSet : public KMultiTable<T, T, Lock, Alloc>
+{
+	CLASS_NO_COPY(KMultiSet)
+public:
+	explicit KMultiSet() {}
+	~KMultiSet() {}
+
+	__checkReturn_opt
+	bool Insert(__in const T& val)
+	{
+		return this->InsertItem(val, val);
+	}
+
+	// Erases the earliest inserted item equal to given one. Returns false if there is none.
+	__checkReturn_opt
+	bool Erase(__in const T& val)
+	{
+		Any_t pred;
+		return this->EraseFirst(val, pred);
+	}
+
+private:
+	struct Any_t
+	{
+		bool operator()(const T&) const
+		{
+			return true;
+		}
+	};
+};
+
+// Lookaside flavours are not offered, since chunks of items vary in size.
+template <typename T> struct KPagedPoolMultiSet
+{
+	typedef KMultiSet< T, KGuardedMutex, typename KPagedPoolAllocator<T>::Type > Type;
+};
+
+template <typename T> struct KNonPagedPoolMultiSet
+{
+	typedef KMultiSet< T, KSpinLock, typename KNonPagedPoolAllocator<T>::Type > Type;
+};
+
+template <typename T, ULONG Tag> struct KTaggedPagedPoolMultiSet
+{
+	typedef KMultiSet< T, KGuardedMutex, typename KTaggedPagedPoolAllocator<T, Tag>::Type > Type;
+};
+
+template <typename T, ULONG Tag> struct KTaggedNonPagedPoolMultiSet
+{
+	typedef KMultiSet< T, KSpinLock, typename KTaggedNonPagedPoolAllocator<T, Tag>::Type > Type;
+};
\ No newline at end of file
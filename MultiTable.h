@@ -0,0 +1,398 @@
+#pragma once
+
+#include "Map.h"
+
+// Ordered table allowing duplicate keys, the common part of KMultiMap and KMultiSet. Every distinct key takes
+// a single node of an AVL map, and items sharing the key are stored in insertion order in a list of chunks
+// hanging off that node. A chunk holds a run of items contiguously and the next chunk doubles the capacity
+// up to s_maxCapacity, so a key with n items takes O(log s_maxCapacity + n / s_maxCapacity) allocations
+// and its items are read sequentially. The allocator must serve requests of arbitrary size since chunks
+// are allocated through it.
+template <typename Key, typename T, typename Lock, typename Alloc> class KMultiTable
+{
+	CLASS_NO_COPY(KMultiTable)
+
+	struct Chunk_t;
+public:
+	typedef Key Key_t;
+	typedef T Val_t;
+	typedef T& Ref_t;
+	typedef const T& CRef_t;
+	typedef T* Ptr_t;
+	typedef const T* CPtr_t;
+	typedef size_t Size_t;
+
+	// Walks the items of a single key in insertion order. Iterators stay valid until items of the key
+	// are erased. Stepping does not take the lock, so the key must not be modified meanwhile.
+	class Iter_t
+	{
+		friend class KMultiTable;
+
+		Chunk_t* m_chunk;
+		Size_t m_index;
+
+	public:
+		Iter_t()
+			: m_chunk(NULL)
+			, m_index(0)
+		{
+		}
+
+		Iter_t(const Iter_t& other)
+			: m_chunk(other.m_chunk)
+			, m_index(other.m_index)
+		{
+		}
+
+		Iter_t& operator++()
+		{
+			if (++m_index == m_chunk->count)
+			{
+				m_chunk = m_chunk->next;
+				m_index = 0;
+			}
+
+			return *this;
+		}
+
+		Iter_t operator++(int)
+		{
+			Iter_t tmp(*this);
+			operator++();
+			return tmp;
+		}
+
+		bool operator == (const Iter_t& other) const
+		{
+			return (m_chunk == other.m_chunk) && (m_index == other.m_index);
+		}
+
+		bool operator != (const Iter_t& other) const
+		{
+			return !operator==(other);
+		}
+
+		Ref_t operator * ()
+		{
+			return m_chunk->GetItems()[m_index];
+		}
+
+		Ptr_t operator -> ()
+		{
+			return &m_chunk->GetItems()[m_index];
+		}
+	};
+
+	// Half-open range of iterators.
+	typedef KPair<Iter_t, Iter_t> Range_t;
+
+	explicit KMultiTable()
+		: m_size(0)
+	{
+	}
+
+	~KMultiTable()
+	{
+		Cleanup();
+	}
+
+	// Number of items with the key.
+	__checkReturn
+	Size_t Count(__in const Key_t& key)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		NodeIter_t node = m_map.Find(key);
+		return (node != m_map.End()) ? node->second.count : 0;
+	}
+
+	__checkReturn
+	bool Contains(__in const Key_t& key)
+	{
+		return Count(key) != 0;
+	}
+
+	// Items with the key in insertion order. The range is empty if the key is absent. The lock is dropped
+	// on return, and erasing items of the key frees the chunks the iterators point to, so the range is safe
+	// to walk only while nobody erases them. ForEqual() walks the items under the lock instead.
+	__checkReturn
+	Range_t EqualRange(__in const Key_t& key)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		NodeIter_t node = m_map.Find(key);
+
+		Iter_t first;
+		if (node != m_map.End())
+			first.m_chunk = node->second.first;
+
+		return Range_t(first, Iter_t());
+	}
+
+	// Calls the functor for every item with the key in insertion order within a single lock acquisition.
+	// The functor receives Ref_t of the item and must not call back into the table.
+	template <typename Func> void ForEqual(__in const Key_t& key, __in Func& func)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		NodeIter_t node = m_map.Find(key);
+		if (node == m_map.End())
+			return;
+
+		for (Chunk_t* chunk = node->second.first; chunk; chunk = chunk->next)
+		{
+			for (Size_t i = 0; i < chunk->count; i++)
+				func(chunk->GetItems()[i]);
+		}
+	}
+
+	// Calls the functor as func(key, item) for every item, keys ascending and items of a key in insertion order.
+	// The functor must not call back into the table.
+	template <typename Func> void ForEach(__in Func& func)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		for (NodeIter_t node = m_map.Begin(); node != m_map.End(); ++node)
+		{
+			for (Chunk_t* chunk = node->second.first; chunk; chunk = chunk->next)
+			{
+				for (Size_t i = 0; i < chunk->count; i++)
+					func(node->first, chunk->GetItems()[i]);
+			}
+		}
+	}
+
+	// Erases every item with the key and returns their number.
+	__checkReturn_opt
+	Size_t EraseAll(__in const Key_t& key)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		NodeIter_t node = m_map.Find(key);
+		if (node == m_map.End())
+			return 0;
+
+		Size_t count = node->second.count;
+		FreeChunks(node->second.first);
+		m_map.Erase(key);
+		m_size -= count;
+
+		return count;
+	}
+
+	// Total number of items.
+	Size_t GetSize()
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		return m_size;
+	}
+
+	// Number of distinct keys.
+	Size_t GetKeyCount()
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		return m_map.GetSize();
+	}
+
+	bool IsEmpty()
+	{
+		return GetSize() == 0;
+	}
+
+	void Cleanup()
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		for (NodeIter_t node = m_map.Begin(); node != m_map.End(); ++node)
+			FreeChunks(node->second.first);
+
+		m_map.Cleanup();
+		m_size = 0;
+	}
+
+	Lock& GetLock()
+	{
+		return m_lock;
+	}
+
+protected:
+	// Appends the item to the items of the key. Returns false if either the node or the chunk could not be allocated.
+	__checkReturn
+	bool InsertItem(__in const Key_t& key, __in CRef_t val)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		typename Map_t::InsertResult_t res = m_map.TryEmplace(key);
+		if (!res.first)
+			return false;
+
+		Bucket_t& bucket = res.first->second;
+		Chunk_t* chunk = bucket.last;
+		if (!chunk || (chunk->count == chunk->capacity))
+		{
+			Size_t capacity = (chunk) ? chunk->capacity << 1 : s_initialCapacity;
+			if (capacity > s_maxCapacity)
+				capacity = s_maxCapacity;
+
+			chunk = AllocateChunk(capacity);
+			if (!chunk)
+			{
+				// Key inserted just now must not stay without items.
+				if (res.second)
+					m_map.Erase(key);
+
+				return false;
+			}
+
+			if (bucket.last)
+				bucket.last->next = chunk;
+			else
+				bucket.first = chunk;
+
+			bucket.last = chunk;
+		}
+
+		Ptr_t item = &chunk->GetItems()[chunk->count];
+		m_itemAllocator.Construct(item);
+		*item = val;
+
+		chunk->count++;
+		bucket.count++;
+		m_size++;
+
+		return true;
+	}
+
+	// Erases the first item of the key satisfying the predicate. Later items of the chunk move down to keep
+	// insertion order, and the chunk is freed once it is empty.
+	template <typename Pred>
+	__checkReturn
+	bool EraseFirst(__in const Key_t& key, __in Pred& pred)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		NodeIter_t node = m_map.Find(key);
+		if (node == m_map.End())
+			return false;
+
+		Bucket_t& bucket = node->second;
+		Chunk_t* prev = NULL;
+		for (Chunk_t* chunk = bucket.first; chunk; prev = chunk, chunk = chunk->next)
+		{
+			Ptr_t items = chunk->GetItems();
+			for (Size_t i = 0; i < chunk->count; i++)
+			{
+				if (!pred(items[i]))
+					continue;
+
+				for (Size_t j = i + 1; j < chunk->count; j++)
+					items[j - 1] = items[j];
+
+				m_itemAllocator.Destroy(&items[--chunk->count]);
+				bucket.count--;
+				m_size--;
+
+				if (!chunk->count)
+				{
+					if (prev)
+						prev->next = chunk->next;
+					else
+						bucket.first = chunk->next;
+
+					if (bucket.last == chunk)
+						bucket.last = prev;
+
+					FreeChunk(chunk);
+				}
+
+				if (!bucket.count)
+					m_map.Erase(key);
+
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+private:
+	// Header is aligned, so that items following it are aligned as the pool aligns allocations.
+	struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) Chunk_t
+	{
+		Chunk_t* next;
+		Size_t count;
+		Size_t capacity;
+
+		Chunk_t()
+			: next(NULL)
+			, count(0)
+			, capacity(0)
+		{
+		}
+
+		~Chunk_t() {}
+
+		Ptr_t GetItems()
+		{
+			return reinterpret_cast<Ptr_t>(this + 1);
+		}
+	};
+
+	struct Bucket_t
+	{
+		Chunk_t* first;
+		Chunk_t* last;
+		Size_t count;
+
+		Bucket_t()
+			: first(NULL)
+			, last(NULL)
+			, count(0)
+		{
+		}
+	};
+
+	// Inner map relies on m_lock.
+	typedef KPair<Key_t, Bucket_t> Node_t;
+	typedef KPoolMap< Key_t, Bucket_t, KNullLock, typename Alloc::template Rebind_t<Node_t>::Other_t > Map_t;
+	typedef typename Map_t::Iter_t NodeIter_t;
+	typedef typename Alloc::template Rebind_t<Chunk_t>::Other_t ChunkAlloc_t;
+	typedef typename Alloc::template Rebind_t<T>::Other_t ItemAlloc_t;
+
+	static const Size_t s_initialCapacity = 4;
+	static const Size_t s_maxCapacity = 256;
+
+private:
+	__checkReturn
+	Chunk_t* AllocateChunk(__in Size_t capacity)
+	{
+		Chunk_t* chunk = m_chunkAllocator.Allocate(sizeof(Chunk_t) + capacity * sizeof(T));
+		ASSERT(chunk);
+
+		if (!chunk)
+			return NULL;
+
+		m_chunkAllocator.Construct(chunk);
+		chunk->capacity = capacity;
+
+		return chunk;
+	}
+
+	void FreeChunk(__in Chunk_t* chunk)
+	{
+		for (Size_t i = 0; i < chunk->count; i++)
+			m_itemAllocator.Destroy(&chunk->GetItems()[i]);
+
+		m_chunkAllocator.Destroy(chunk);
+		m_chunkAllocator.Deallocate(chunk);
+	}
+
+	void FreeChunks(__in Chunk_t* chunk)
+	{
+		while (chunk)
+		{
+			Chunk_t* next = chunk->next;
+			FreeChunk(chunk);
+			chunk = next;
+		}
+	}
+
+private:
+	Lock m_lock;
+	Map_t m_map;
+	ChunkAlloc_t m_chunkAllocator;
+	ItemAlloc_t m_itemAllocator;
+	Size_t m_size;
+};
\ No newline at end of file
@@ -0,0 +1,946 @@
+#pragma once
+
+#include "CommonDefinitions.h"
+#include "Synch.h"
+#include "Allocator.h"
+#include "Utility.h"
+
+// AVL tree implemented in the template itself rather than on top of RTL_AVL_TABLE. The comparison of the concrete
+// tree is called through CRTP and the nodes are allocated by the rebound allocator directly, so no call goes
+// through a function pointer and the compiler is free to inline the whole search. Every node is a plain struct
+// holding the links followed by the item, thus items are reached by the member rather than by offset arithmetic
+// and are aligned as Val_t requires. Public interface and iterator semantics match KAvlTree, so either tree
+// may serve as the engine of KMap and KSet. The comparison returns RTL_GENERIC_COMPARE_RESULTS for the same reason.
+// Nodes are of fixed size, so lookaside allocators serve the tree as well as pool ones.
+template
+<
+	typename ConcreteTree,
+	typename Lock,
+	typename Alloc,
+	typename KeyOf = KIdentityKey<typename Alloc::Val_t>
+> class KNativeAvlTree
+{
+	CLASS_NO_COPY(KNativeAvlTree)
+
+	struct Node_t;
+public:
+	typedef Lock Lock_t;
+	typedef Alloc Alloc_t;
+	typedef typename KeyOf::Key_t Key_t;
+	typedef typename Alloc::Val_t Val_t;
+	typedef typename Alloc::Ref_t Ref_t;
+	typedef typename Alloc::CRef_t CRef_t;
+	typedef typename Alloc::Ptr_t Ptr_t;
+	typedef typename Alloc::CPtr_t CPtr_t;
+	typedef ptrdiff_t Dif_t;
+	typedef size_t Size_t;
+
+	// Item found or inserted and flag telling whether it has been inserted by the call.
+	typedef KPair<Ptr_t, bool> InsertResult_t;
+
+	// Begin(), Find() and stepping take the lock shared for the call only, so the lock must not be held
+	// across them. Nothing keeps the current item alive between calls, hence erasing it invalidates
+	// the iterator. Walks which must see a stable tree belong in ForEach() or ForRange().
+	class Iter_t
+	{
+		friend class KNativeAvlTree;
+
+		KNativeAvlTree* m_target;
+		Ptr_t m_current;
+
+	public:
+		Iter_t(KNativeAvlTree* target)
+			: m_target(target)
+			, m_current(NULL)
+		{
+		}
+
+		Iter_t(const Iter_t& other)
+			: m_target(other.m_target)
+			, m_current(other.m_current)
+		{
+		}
+
+		// Successor is found by parent links, so stepping does not modify the tree and any number
+		// of iterators may advance in parallel under the shared lock.
+		Iter_t& operator++()
+		{
+			KSharedLocker<Lock> locker(m_target->m_lock);
+			m_current = m_target->LockedNext(m_current);
+			return *this;
+		}
+
+		Iter_t operator++(int)
+		{
+			Iter_t tmp(*this);
+			operator++();
+			return tmp;
+		}
+
+		bool operator == (const Iter_t& other) const
+		{
+			return m_current == other.m_current;
+		}
+
+		bool operator != (const Iter_t& other) const
+		{
+			return m_current != other.m_current;
+		}
+
+		Ref_t operator * ()
+		{
+			return *m_current;
+		}
+
+		Ptr_t operator -> ()
+		{
+			return m_current;
+		}
+	};
+
+	// Half-open range of iterators.
+	typedef KPair<Iter_t, Iter_t> Range_t;
+
+	explicit KNativeAvlTree()
+		: m_root(NULL)
+		, m_count(0)
+	{
+	}
+
+	~KNativeAvlTree()
+	{
+		Cleanup();
+	}
+
+	// The whole tree goes away, so nodes are freed in post-order without rebalancing after every removal.
+	__drv_mustHold(Lock)
+	void Cleanup()
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		LockedFreeSubtree(m_root);
+
+		m_root = NULL;
+		m_count = 0;
+	}
+
+	// Builds the tree out of items sorted by key in ascending order in O(n) time. Nodes are linked
+	// straight into a balanced shape, so neither searching nor rebalancing takes place per item.
+	// Unless the tree is empty and keys strictly ascend the items are inserted one by one instead.
+	// Returns false if some item could not be allocated. The fast path leaves the tree empty then.
+	template <typename Iter>
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	bool BuildFromSorted(__in Iter first, __in Iter last)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		return LockedBuildFromSorted(first, last);
+	}
+
+	__drv_mustHold(Lock)
+	Size_t GetSize()
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		return LockedGetSize();
+	}
+
+	bool IsEmpty()
+	{
+		return GetSize() == 0;
+	}
+
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	bool Insert(__in CRef_t val, __in Ptr_t* res = NULL)
+	{
+		InsertResult_t inserted = FindOrInsert(val);
+		if (!inserted.second)
+			return false;
+
+		// Return new item if the caller interested therein.
+		if (res)
+			*res = inserted.first;
+
+		return true;
+	}
+
+	// Looks the item up and inserts it if absent within a single lock acquisition and a single tree walk.
+	// The first member of the result is NULL only when the new item could not be allocated.
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	InsertResult_t FindOrInsert(__in CRef_t val)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		return LockedFindOrInsert(val);
+	}
+
+#if defined(CXX11_MOVE_SEMANTICS)
+	// Same as above yet the item is moved into the tree if inserted.
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	bool Insert(__in Val_t&& val, __in Ptr_t* res = NULL)
+	{
+		InsertResult_t inserted = FindOrInsert(::Move(val));
+		if (!inserted.second)
+			return false;
+
+		if (res)
+			*res = inserted.first;
+
+		return true;
+	}
+
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	InsertResult_t FindOrInsert(__in Val_t&& val)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		return LockedFindOrInsert(::Move(val));
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
+	__checkReturn_opt
+	__drv_mustHold(Lock)
+	bool Erase(__in const Key_t& key)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		return LockedErase(key);
+	}
+
+	__checkReturn
+	__drv_mustHold(Lock)
+	Iter_t Find(__in const Key_t& key)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		return LockedFind(key);
+	}
+
+	__checkReturn
+	__drv_mustHold(Lock)
+	bool Contains(__in const Key_t& key)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		return Lookup(key) != NULL;
+	}
+
+	__drv_mustHold(Lock)
+	Iter_t Begin()
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		Iter_t iterator(this);
+		iterator.m_current = (m_root) ? &GetLeftmost(m_root)->item : NULL;
+		return iterator;
+	}
+
+	Iter_t End()
+	{
+		Iter_t iterator(this);
+		return iterator;
+	}
+
+	// Ordered range queries. A bound is located by a single search which also yields the neighbour
+	// of an absent key, and then iteration proceeds from there, hence a range of k items costs
+	// O(log n + k) under the shared lock.
+
+	// First item whose key is not less than given one.
+	__checkReturn
+	__drv_mustHold(Lock)
+	Iter_t LowerBound(__in const Key_t& key)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		Iter_t iterator(this);
+		iterator.m_current = LockedLowerBound(key);
+		return iterator;
+	}
+
+	// First item whose key is greater than given one.
+	__checkReturn
+	__drv_mustHold(Lock)
+	Iter_t UpperBound(__in const Key_t& key)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		Iter_t iterator(this);
+		iterator.m_current = LockedUpperBound(key);
+		return iterator;
+	}
+
+	// Keys are unique, so the range holds either a single item or none.
+	__checkReturn
+	__drv_mustHold(Lock)
+	Range_t EqualRange(__in const Key_t& key)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		Iter_t first(this);
+		Iter_t last(this);
+
+		first.m_current = LockedLowerBound(key);
+		last.m_current = first.m_current;
+		if (first.m_current && IsEqual(KeyOf::Get(*first.m_current), key))
+			last.m_current = LockedNext(first.m_current);
+
+		return Range_t(first, last);
+	}
+
+	// Calls the functor for every item with key in [first, last) in ascending order within a single lock acquisition.
+	// The functor receives Ref_t of the item and must not call back into the tree.
+	template <typename Func>
+	__drv_mustHold(Lock)
+	void ForRange(__in const Key_t& first, __in const Key_t& last, __in Func& func)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		for (Ptr_t item = LockedLowerBound(first); item && IsLess(KeyOf::Get(*item), last); item = LockedNext(item))
+			func(*item);
+	}
+
+	// Calls the functor for every item in ascending order within a single lock acquisition rather than locking
+	// per step as iterators do. The functor receives Ref_t of the item and must not call back into the tree.
+	template <typename Func>
+	__drv_mustHold(Lock)
+	void ForEach(__in Func& func)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		LockedForEach(func);
+	}
+
+	// Lookups, bounds and iterators take the lock by themselves, so holding it across them self-deadlocks
+	// on an exclusive lock.
+	Lock& GetLock()
+	{
+		return m_lock;
+	}
+
+protected:
+	// Same locked helpers KAvlTree offers, so adapters work with either engine.
+	template <typename Iter>
+	__checkReturn_opt
+	bool LockedBuildFromSorted(__in Iter first, __in Iter last)
+	{
+		Size_t count = 0;
+		bool sorted = true;
+
+		for (Iter prev = first, it = first; it != last; prev = it, ++it, ++count)
+		{
+			if (count && !IsLess(KeyOf::Get(*prev), KeyOf::Get(*it)))
+				sorted = false;
+		}
+
+		if (!sorted || m_root)
+		{
+			bool res = true;
+			for (Iter it = first; it != last; ++it)
+			{
+				if (!LockedFindOrInsert(*it).first)
+					res = false;
+			}
+
+			return res;
+		}
+
+		Node_t* root = NULL;
+		ULONG height = 0;
+		if (!LockedBuildSubtree(first, count, &root, &height))
+			return false;
+
+		m_root = root;
+		m_count = count;
+
+		return true;
+	}
+
+	__checkReturn_opt
+	bool LockedErase(__in const Key_t& key)
+	{
+		Ptr_t item = Lookup(key);
+		if (!item)
+			return false;
+
+		LockedEraseNode(GetNode(item));
+		return true;
+	}
+
+	__checkReturn
+	Iter_t LockedFind(__in const Key_t& key)
+	{
+		Iter_t iterator(this);
+		iterator.m_current = Lookup(key);
+		return iterator;
+	}
+
+	Size_t LockedGetSize()
+	{
+		return m_count;
+	}
+
+	template <typename Func> void LockedForEach(__in Func& func)
+	{
+		for (Ptr_t item = (m_root) ? &GetLeftmost(m_root)->item : NULL; item; item = LockedNext(item))
+			func(*item);
+	}
+
+	// Caller must hold the lock. Insertion reuses the parent node and the side found by the lookup
+	// so the tree is not searched again.
+	__checkReturn
+	InsertResult_t LockedFindOrInsert(__in CRef_t val)
+	{
+		PVOID nodeOrParent = NULL;
+		TABLE_SEARCH_RESULT searchResult = TableEmptyTree;
+
+		Ptr_t item = LockedLookup(KeyOf::Get(val), &nodeOrParent, &searchResult);
+		if (item)
+			return InsertResult_t(item, false);
+
+		return LockedInsertAt(val, nodeOrParent, searchResult);
+	}
+
+#if defined(CXX11_MOVE_SEMANTICS)
+	__checkReturn
+	InsertResult_t LockedFindOrInsert(__in Val_t&& val)
+	{
+		PVOID nodeOrParent = NULL;
+		TABLE_SEARCH_RESULT searchResult = TableEmptyTree;
+
+		Ptr_t item = LockedLookup(KeyOf::Get(val), &nodeOrParent, &searchResult);
+		if (item)
+			return InsertResult_t(item, false);
+
+		return LockedInsertAt(::Move(val), nodeOrParent, searchResult);
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
+	// Caller must hold the lock. Besides the item found returns the position where the key should be inserted
+	// the same way RtlLookupElementGenericTableFullAvl() does.
+	__checkReturn
+	Ptr_t LockedLookup(__in const Key_t& key, __out PVOID* nodeOrParent, __out TABLE_SEARCH_RESULT* searchResult)
+	{
+		*nodeOrParent = NULL;
+		*searchResult = TableEmptyTree;
+
+		Node_t* node = m_root;
+		while (node)
+		{
+			*nodeOrParent = node;
+
+			switch (static_cast<ConcreteTree*>(this)->OnCompare(key, KeyOf::Get(node->item)))
+			{
+			case GenericLessThan:
+				*searchResult = TableInsertAsLeft;
+				node = node->left;
+				break;
+
+			case GenericGreaterThan:
+				*searchResult = TableInsertAsRight;
+				node = node->right;
+				break;
+
+			default:
+				*searchResult = TableFoundNode;
+				return &node->item;
+			}
+		}
+
+		return NULL;
+	}
+
+	// Caller must hold the lock and pass the position obtained by LockedLookup() under the same lock acquisition.
+	__checkReturn
+	InsertResult_t LockedInsertAt(__in CRef_t val, __in PVOID nodeOrParent, __in TABLE_SEARCH_RESULT searchResult)
+	{
+		ASSERT(searchResult != TableFoundNode);
+
+		Node_t* node = AllocateNode(val);
+		if (!node)
+			return InsertResult_t(NULL, false);
+
+		LockedLink(node, nodeOrParent, searchResult);
+		return InsertResult_t(&node->item, true);
+	}
+
+#if defined(CXX11_MOVE_SEMANTICS)
+	__checkReturn
+	InsertResult_t LockedInsertAt(__in Val_t&& val, __in PVOID nodeOrParent, __in TABLE_SEARCH_RESULT searchResult)
+	{
+		ASSERT(searchResult != TableFoundNode);
+
+		Node_t* node = AllocateNode(::Move(val));
+		if (!node)
+			return InsertResult_t(NULL, false);
+
+		LockedLink(node, nodeOrParent, searchResult);
+		return InsertResult_t(&node->item, true);
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
+	// Caller must hold the lock exclusively. Hangs the new node at the position and rebalances the tree.
+	void LockedLink(__in Node_t* node, __in PVOID nodeOrParent, __in TABLE_SEARCH_RESULT searchResult)
+	{
+		Node_t* parent = reinterpret_cast<Node_t*>(nodeOrParent);
+		node->parent = parent;
+
+		if (!parent)
+			m_root = node;
+		else if (searchResult == TableInsertAsLeft)
+			parent->left = node;
+		else
+			parent->right = node;
+
+		m_count++;
+		RebalanceAfterInsert(node);
+	}
+
+	// Caller must hold the lock exclusively. The node is unlinked and freed, items of other nodes stay in place,
+	// so iterators pointing to them remain valid.
+	void LockedEraseNode(__in Node_t* node)
+	{
+		Node_t* parent = NULL;
+		bool fromLeft = false;
+
+		if (node->left && node->right)
+		{
+			// Successor takes the place of the node, so the tree shrinks where the successor used to be.
+			Node_t* successor = GetLeftmost(node->right);
+			if (successor == node->right)
+			{
+				parent = successor;
+				fromLeft = false;
+			}
+			else
+			{
+				parent = successor->parent;
+				fromLeft = true;
+
+				parent->left = successor->right;
+				if (successor->right)
+					successor->right->parent = parent;
+
+				successor->right = node->right;
+				node->right->parent = successor;
+			}
+
+			successor->left = node->left;
+			node->left->parent = successor;
+			successor->balance = node->balance;
+			Replace(node, successor);
+		}
+		else
+		{
+			Node_t* child = (node->left) ? node->left : node->right;
+			parent = node->parent;
+			fromLeft = parent && (parent->left == node);
+
+			if (child)
+				child->parent = parent;
+
+			Replace(node, child);
+		}
+
+		m_count--;
+		FreeNode(node);
+		RebalanceAfterErase(parent, fromLeft);
+	}
+
+	// Caller must hold the lock exclusively. Splits the items the way KAvlTree::LockedBuildSubtree() does,
+	// so balance factors come out within AVL bounds. On failure everything built so far is freed.
+	template <typename Iter>
+	__checkReturn
+	bool LockedBuildSubtree(__inout Iter& it, __in Size_t count, __out Node_t** subtree, __out ULONG* height)
+	{
+		*subtree = NULL;
+		*height = 0;
+
+		if (!count)
+			return true;
+
+		Node_t* left = NULL;
+		ULONG leftHeight = 0;
+		if (!LockedBuildSubtree(it, count / 2, &left, &leftHeight))
+			return false;
+
+		Node_t* node = AllocateNode(*it);
+		if (!node)
+		{
+			LockedFreeSubtree(left);
+			return false;
+		}
+
+		++it;
+
+		Node_t* right = NULL;
+		ULONG rightHeight = 0;
+		if (!LockedBuildSubtree(it, count - count / 2 - 1, &right, &rightHeight))
+		{
+			LockedFreeSubtree(left);
+			FreeNode(node);
+			return false;
+		}
+
+		node->left = left;
+		node->right = right;
+
+		if (left)
+			left->parent = node;
+
+		if (right)
+			right->parent = node;
+
+		node->balance = static_cast<CHAR>(static_cast<LONG>(rightHeight) - static_cast<LONG>(leftHeight));
+
+		*subtree = node;
+		*height = ((leftHeight > rightHeight) ? leftHeight : rightHeight) + 1;
+
+		return true;
+	}
+
+	// Caller must hold the lock exclusively. Frees the subtree bottom up walking parent links, so no stack
+	// is needed whatever the depth. Links pointing to the subtree from outside are left for the caller to fix.
+	void LockedFreeSubtree(__in Node_t* subtree)
+	{
+		Node_t* node = subtree;
+		while (node)
+		{
+			if (node->left)
+			{
+				node = node->left;
+				continue;
+			}
+
+			if (node->right)
+			{
+				node = node->right;
+				continue;
+			}
+
+			Node_t* parent = (node != subtree) ? node->parent : NULL;
+			if (parent)
+			{
+				if (parent->left == node)
+					parent->left = NULL;
+				else
+					parent->right = NULL;
+			}
+
+			FreeNode(node);
+			node = parent;
+		}
+	}
+
+	// Caller must hold the lock, either shared or exclusive.
+	__checkReturn
+	Ptr_t Lookup(__in const Key_t& key)
+	{
+		PVOID nodeOrParent = NULL;
+		TABLE_SEARCH_RESULT searchResult = TableEmptyTree;
+
+		return LockedLookup(key, &nodeOrParent, &searchResult);
+	}
+
+	// Caller must hold the lock, either shared or exclusive.
+	__checkReturn
+	Ptr_t LockedLowerBound(__in const Key_t& key)
+	{
+		PVOID nodeOrParent = NULL;
+		TABLE_SEARCH_RESULT searchResult = TableEmptyTree;
+
+		Ptr_t item = LockedLookup(key, &nodeOrParent, &searchResult);
+		if (item)
+			return item;
+
+		return LockedBoundFromParent(nodeOrParent, searchResult);
+	}
+
+	__checkReturn
+	Ptr_t LockedUpperBound(__in const Key_t& key)
+	{
+		PVOID nodeOrParent = NULL;
+		TABLE_SEARCH_RESULT searchResult = TableEmptyTree;
+
+		Ptr_t item = LockedLookup(key, &nodeOrParent, &searchResult);
+		if (item)
+			return LockedNext(item);
+
+		return LockedBoundFromParent(nodeOrParent, searchResult);
+	}
+
+	// Translates position of an absent key into the first item greater than the key. Left child of the parent
+	// is vacant, so the parent itself follows the key. Right child is vacant, so the key falls between the parent
+	// and its successor.
+	__checkReturn
+	Ptr_t LockedBoundFromParent(__in PVOID parent, __in TABLE_SEARCH_RESULT searchResult)
+	{
+		switch (searchResult)
+		{
+		case TableInsertAsLeft:
+			return &reinterpret_cast<Node_t*>(parent)->item;
+
+		case TableInsertAsRight:
+			return LockedNext(&reinterpret_cast<Node_t*>(parent)->item);
+
+		default:
+			return NULL;
+		}
+	}
+
+	// Leftmost node of the right subtree or else the first ancestor reached from its left subtree.
+	__checkReturn
+	Ptr_t LockedNext(__in Ptr_t item)
+	{
+		if (!item)
+			return NULL;
+
+		Node_t* node = GetNode(item);
+		if (node->right)
+			return &GetLeftmost(node->right)->item;
+
+		Node_t* parent = node->parent;
+		while (parent && (parent->right == node))
+		{
+			node = parent;
+			parent = node->parent;
+		}
+
+		return (parent) ? &parent->item : NULL;
+	}
+
+	bool IsLess(__in const Key_t& x, __in const Key_t& y)
+	{
+		return static_cast<ConcreteTree*>(this)->OnCompare(x, y) == GenericLessThan;
+	}
+
+	bool IsEqual(__in const Key_t& x, __in const Key_t& y)
+	{
+		return static_cast<ConcreteTree*>(this)->OnCompare(x, y) == GenericEqual;
+	}
+
+private:
+	// Balance is the height of the right subtree less the height of the left one.
+	struct Node_t
+	{
+		Node_t* left;
+		Node_t* right;
+		Node_t* parent;
+		CHAR balance;
+		Val_t item;
+
+		Node_t()
+			: left(NULL)
+			, right(NULL)
+			, parent(NULL)
+			, balance(0)
+			, item()
+		{
+		}
+
+		~Node_t() {}
+	};
+
+	typedef typename Alloc::template Rebind_t<Node_t>::Other_t NodeAlloc_t;
+
+private:
+	__checkReturn
+	Node_t* AllocateNode(__in CRef_t val)
+	{
+		Node_t* node = m_allocator.Allocate(sizeof(Node_t));
+		if (!node)
+			return NULL;
+
+		m_allocator.Construct(node);
+		node->item = val;
+
+		return node;
+	}
+
+#if defined(CXX11_MOVE_SEMANTICS)
+	__checkReturn
+	Node_t* AllocateNode(__in Val_t&& val)
+	{
+		Node_t* node = m_allocator.Allocate(sizeof(Node_t));
+		if (!node)
+			return NULL;
+
+		m_allocator.Construct(node);
+		node->item = ::Move(val);
+
+		return node;
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
+	void FreeNode(__in Node_t* node)
+	{
+		m_allocator.Destroy(node);
+		m_allocator.Deallocate(node);
+	}
+
+	static Node_t* GetNode(__in Ptr_t item)
+	{
+		return CONTAINING_RECORD(item, Node_t, item);
+	}
+
+	static Node_t* GetLeftmost(__in Node_t* node)
+	{
+		while (node->left)
+			node = node->left;
+
+		return node;
+	}
+
+	// Puts the replacement, which may be NULL, in place of the node within its parent.
+	void Replace(__in Node_t* node, __in_opt Node_t* replacement)
+	{
+		Node_t* parent = node->parent;
+		if (replacement)
+			replacement->parent = parent;
+
+		if (!parent)
+			m_root = replacement;
+		else if (parent->left == node)
+			parent->left = replacement;
+		else
+			parent->right = replacement;
+	}
+
+	void RotateLeft(__in Node_t* node)
+	{
+		Node_t* pivot = node->right;
+
+		node->right = pivot->left;
+		if (pivot->left)
+			pivot->left->parent = node;
+
+		Replace(node, pivot);
+		pivot->left = node;
+		node->parent = pivot;
+	}
+
+	void RotateRight(__in Node_t* node)
+	{
+		Node_t* pivot = node->left;
+
+		node->left = pivot->right;
+		if (pivot->right)
+			pivot->right->parent = node;
+
+		Replace(node, pivot);
+		pivot->right = node;
+		node->parent = pivot;
+	}
+
+	// Restores balance of the node leaning by two to either side and returns the root of the rotated subtree.
+	// Sets the flag if the subtree got lower than it was before the rotation, which is always the case
+	// except for a single rotation about a child in balance, possible after erasure only.
+	Node_t* Rotate(__in Node_t* node, __out bool* lowered)
+	{
+		*lowered = true;
+
+		if (node->balance > 0)
+		{
+			Node_t* child = node->right;
+			if (child->balance < 0)
+			{
+				Node_t* grandchild = child->left;
+				RotateRight(child);
+				RotateLeft(node);
+
+				node->balance = (grandchild->balance > 0) ? -1 : 0;
+				child->balance = (grandchild->balance < 0) ? 1 : 0;
+				grandchild->balance = 0;
+
+				return grandchild;
+			}
+
+			RotateLeft(node);
+			if (child->balance == 0)
+			{
+				node->balance = 1;
+				child->balance = -1;
+				*lowered = false;
+			}
+			else
+			{
+				node->balance = 0;
+				child->balance = 0;
+			}
+
+			return child;
+		}
+		else
+		{
+			Node_t* child = node->left;
+			if (child->balance > 0)
+			{
+				Node_t* grandchild = child->right;
+				RotateLeft(child);
+				RotateRight(node);
+
+				node->balance = (grandchild->balance < 0) ? 1 : 0;
+				child->balance = (grandchild->balance > 0) ? -1 : 0;
+				grandchild->balance = 0;
+
+				return grandchild;
+			}
+
+			RotateRight(node);
+			if (child->balance == 0)
+			{
+				node->balance = -1;
+				child->balance = 1;
+				*lowered = false;
+			}
+			else
+			{
+				node->balance = 0;
+				child->balance = 0;
+			}
+
+			return child;
+		}
+	}
+
+	// Walks up while subtrees grow. A rotation brings the subtree back to its former height, so it ends the walk.
+	void RebalanceAfterInsert(__in Node_t* node)
+	{
+		for (Node_t* parent = node->parent; parent; node = parent, parent = node->parent)
+		{
+			parent->balance += (parent->left == node) ? -1 : 1;
+
+			if (parent->balance == 0)
+				break;
+
+			if ((parent->balance == 2) || (parent->balance == -2))
+			{
+				bool lowered = false;
+				Rotate(parent, &lowered);
+				break;
+			}
+		}
+	}
+
+	// Walks up while subtrees get lower, starting from the parent whose left or right subtree has got lower.
+	void RebalanceAfterErase(__in_opt Node_t* parent, __in bool fromLeft)
+	{
+		while (parent)
+		{
+			parent->balance += (fromLeft) ? 1 : -1;
+
+			Node_t* node = parent;
+			if ((parent->balance == 1) || (parent->balance == -1))
+				break;
+
+			if (parent->balance != 0)
+			{
+				bool lowered = false;
+				node = Rotate(parent, &lowered);
+				if (!lowered)
+					break;
+			}
+
+			parent = node->parent;
+			fromLeft = parent && (parent->left == node);
+		}
+	}
+
+protected:
+	Lock m_lock;
+
+private:
+	NodeAlloc_t m_allocator;
+	Node_t* m_root;
+	Size_t m_count;
+};
\ No newline at end of file
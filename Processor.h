@@ -0,0 +1,37 @@
+#pragma once
+
+#include "CommonDefinitions.h"
+
+// Number of active processors. All processor groups are counted on systems which support them.
+inline ULONG GetProcessorCount()
+{
+#if (NTDDI_VERSION >= NTDDI_WIN7)
+	return KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+#else
+	return KeQueryActiveProcessorCount(NULL);
+#endif
+}
+
+// Number of processors the system may ever have, those hot added later included. Per processor arrays
+// sized by it may be indexed by GetCurrentProcessorIndex() without wrapping.
+inline ULONG GetMaxProcessorCount()
+{
+#if (NTDDI_VERSION >= NTDDI_WIN7)
+	return KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+#elif (NTDDI_VERSION >= NTDDI_VISTA)
+	return KeQueryMaximumProcessorCount();
+#else
+	return MAXIMUM_PROCESSORS;
+#endif
+}
+
+// System wide index of the current processor. It is less than GetProcessorCount() unless processors
+// have been added since the count was taken, so per processor arrays should not rely on it blindly.
+inline ULONG GetCurrentProcessorIndex()
+{
+#if (NTDDI_VERSION >= NTDDI_WIN7)
+	return KeGetCurrentProcessorNumberEx(NULL);
+#else
+	return KeGetCurrentProcessorNumber();
+#endif
+}
\ No newline at end of file
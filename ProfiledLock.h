@@ -0,0 +1,497 @@
+#pragma once
+
+#include "CommonDefinitions.h"
+#include "KernelNew.h"
+#include "Processor.h"
+#include "Synch.h"
+#include "TypeTraits.h"
+
+// Contention profiling of the locks of Synch.h. KProfiledLock<T> wraps any KLock or KRWLock implementation
+// and is accepted wherever the bare lock is, so a suspected lock is profiled by changing its type only.
+// Profiling is opt-in: define LOCK_PROFILING in the project settings, otherwise KProfiledLock<T> is the bare
+// lock and the registry enumerates nothing.
+
+// Number of wait time histogram buckets. Bucket 0 counts waits below a microsecond, bucket i waits
+// of [2^(i-1), 2^i) microseconds, and the last one every longer wait.
+const ULONG lockWaitBuckets = 16;
+
+// Statistics of a profiled lock summed over processors. Times are in microseconds. Hold times are measured
+// for exclusive acquisitions only, since shared holders of a lock release it in any order.
+struct KLockStats
+{
+	ULONG64 acquisitions;
+	ULONG64 contended;
+	ULONG64 totalWait;
+	ULONG64 maxWait;
+	ULONG64 totalHold;
+	ULONG64 maxHold;
+	ULONG64 waitHistogram[lockWaitBuckets];
+
+	KLockStats()
+	{
+		RtlZeroMemory(this, sizeof(KLockStats));
+	}
+};
+
+#ifdef LOCK_PROFILING
+
+class KLockProfileRegistry;
+
+// Part of the profiled lock independent of the lock type, which is what the registry links.
+// Counters are kept per processor, so that profiling adds no cache line shared by all acquirers.
+// A thread waiting at PASSIVE_LEVEL may move to another processor meanwhile, thus counters are
+// updated by interlocked operations, which cost little on a line the processor mostly owns alone.
+class KProfiledLockBase
+{
+	CLASS_NO_COPY(KProfiledLockBase)
+	friend class KLockProfileRegistry;
+public:
+	// Links the lock to the registry under the name, which must outlive the lock. Used for locks
+	// constructed without one, e.g. the ones containers embed.
+	void Register(__in KLockProfileRegistry& registry, __in PCSTR name);
+
+	PCSTR GetName() const
+	{
+		return m_name;
+	}
+
+	// Snapshot only, acquisitions in flight may or may not be counted.
+	void GetStats(__out KLockStats* stats)
+	{
+		*stats = KLockStats();
+		if (!m_slots)
+			return;
+
+		for (ULONG i = 0; i < m_slotCount; i++)
+		{
+			const Slot_t& slot = m_slots[i];
+			stats->acquisitions += slot.acquisitions;
+			stats->contended += slot.contended;
+			stats->totalWait += slot.totalWait;
+			stats->totalHold += slot.totalHold;
+
+			if (stats->maxWait < static_cast<ULONG64>(slot.maxWait))
+				stats->maxWait = slot.maxWait;
+
+			if (stats->maxHold < static_cast<ULONG64>(slot.maxHold))
+				stats->maxHold = slot.maxHold;
+
+			for (ULONG j = 0; j < lockWaitBuckets; j++)
+				stats->waitHistogram[j] += slot.waitHistogram[j];
+		}
+
+		stats->totalWait = ToMicroseconds(stats->totalWait);
+		stats->maxWait = ToMicroseconds(stats->maxWait);
+		stats->totalHold = ToMicroseconds(stats->totalHold);
+		stats->maxHold = ToMicroseconds(stats->maxHold);
+	}
+
+protected:
+	explicit KProfiledLockBase()
+		: m_registry(NULL)
+		, m_name(NULL)
+		, m_frequency(0)
+		, m_overhead(MAXLONG64)
+		, m_buffer(NULL)
+		, m_slots(NULL)
+		, m_slotCount(0)
+	{
+		LARGE_INTEGER frequency;
+		KeQueryPerformanceCounter(&frequency);
+		m_frequency = frequency.QuadPart;
+
+		// A counter read takes up to a microsecond where QPC is backed by HPET or the ACPI PM timer,
+		// so the cheapest of a few back to back reads is taken off every wait measured.
+		for (ULONG i = 0; i < 8; i++)
+		{
+			LONG64 start = Now();
+			LONG64 overhead = Now() - start;
+			if (m_overhead > overhead)
+				m_overhead = overhead;
+		}
+
+		// Pool does not align small allocations to the cache line, so an extra line leaves room for that.
+		ULONG count = GetMaxProcessorCount();
+		SIZE_T size = count * sizeof(Slot_t) + SYSTEM_CACHE_ALIGNMENT_SIZE;
+		m_buffer = new (NonPagedPool) UCHAR[size];
+		ASSERT(m_buffer);
+
+		if (!m_buffer)
+			return;
+
+		RtlZeroMemory(m_buffer, size);
+
+		ULONG_PTR aligned = (reinterpret_cast<ULONG_PTR>(m_buffer) + SYSTEM_CACHE_ALIGNMENT_SIZE - 1) & ~static_cast<ULONG_PTR>(SYSTEM_CACHE_ALIGNMENT_SIZE - 1);
+		m_slots = reinterpret_cast<Slot_t*>(aligned);
+		m_slotCount = count;
+	}
+
+	~KProfiledLockBase();
+
+	static LONG64 Now()
+	{
+		return KeQueryPerformanceCounter(NULL).QuadPart;
+	}
+
+	LONG64 Elapsed(__in LONG64 start, __in LONG64 end) const
+	{
+		LONG64 ticks = end - start - m_overhead;
+		return (ticks > 0) ? ticks : 0;
+	}
+
+	// Acquisitions are counted along with their wait. A failed try-acquire is contention for sure. Locks
+	// without one are judged by the wait alone, which counts a microsecond or longer as contended: a free lock
+	// taken across an interrupt or a preemption is miscounted as contended, a busy one granted sooner as not.
+	void RecordWait(__in LONG64 ticks, __in bool failedTry)
+	{
+		if (!m_slots)
+			return;
+
+		Slot_t& slot = GetSlot();
+		InterlockedIncrement64(&slot.acquisitions);
+		InterlockedExchangeAdd64(&slot.totalWait, ticks);
+		UpdateMax(&slot.maxWait, ticks);
+
+		ULONG bucket = GetBucket(ToMicroseconds(ticks));
+		if (failedTry || bucket)
+			InterlockedIncrement64(&slot.contended);
+
+		InterlockedIncrement64(&slot.waitHistogram[bucket]);
+	}
+
+	void RecordHold(__in LONG64 ticks)
+	{
+		if (!m_slots)
+			return;
+
+		Slot_t& slot = GetSlot();
+		InterlockedExchangeAdd64(&slot.totalHold, ticks);
+		UpdateMax(&slot.maxHold, ticks);
+	}
+
+private:
+	struct DECLSPEC_CACHEALIGN Slot_t
+	{
+		volatile LONG64 acquisitions;
+		volatile LONG64 contended;
+		volatile LONG64 totalWait;
+		volatile LONG64 maxWait;
+		volatile LONG64 totalHold;
+		volatile LONG64 maxHold;
+		volatile LONG64 waitHistogram[lockWaitBuckets];
+	};
+
+private:
+	Slot_t& GetSlot()
+	{
+		ULONG index = GetCurrentProcessorIndex();
+		ASSERT(index < m_slotCount);
+
+		return m_slots[index];
+	}
+
+	static void UpdateMax(__inout volatile LONG64* max, __in LONG64 val)
+	{
+		LONG64 current = *max;
+		while (current < val)
+		{
+			LONG64 prev = InterlockedCompareExchange64(max, val, current);
+			if (prev == current)
+				break;
+
+			current = prev;
+		}
+	}
+
+	static ULONG GetBucket(__in ULONG64 usec)
+	{
+		ULONG bucket = 0;
+		while (usec && (bucket < lockWaitBuckets - 1))
+		{
+			usec >>= 1;
+			bucket++;
+		}
+
+		return bucket;
+	}
+
+	// Split so that totals of long runs do not overflow the multiplication.
+	ULONG64 ToMicroseconds(__in ULONG64 ticks) const
+	{
+		ULONG64 frequency = static_cast<ULONG64>(m_frequency);
+		return (ticks / frequency) * 1000000 + (ticks % frequency) * 1000000 / frequency;
+	}
+
+private:
+	LIST_ENTRY m_entry;
+	KLockProfileRegistry* m_registry;
+	PCSTR m_name;
+	LONG64 m_frequency;
+	LONG64 m_overhead;
+	PUCHAR m_buffer;
+	Slot_t* m_slots;
+	ULONG m_slotCount;
+};
+
+// Profiled locks linked by name, e.g. for a timer dumping them periodically. The registry must outlive
+// the locks registered and live in nonpaged memory, since locks may come and go at DISPATCH_LEVEL.
+class KLockProfileRegistry
+{
+	CLASS_NO_COPY(KLockProfileRegistry)
+	friend class KProfiledLockBase;
+public:
+	explicit KLockProfileRegistry()
+	{
+		InitializeListHead(&m_head);
+	}
+
+	~KLockProfileRegistry()
+	{
+		ASSERT(IsListEmpty(&m_head));
+	}
+
+	// Calls the functor as func(name, stats) for every lock registered. The functor runs at DISPATCH_LEVEL
+	// under the registry lock, so it must neither block nor register locks.
+	template <typename Func> void ForEach(__in Func& func)
+	{
+		KLocker<KSpinLock> locker(m_lock);
+		for (PLIST_ENTRY entry = m_head.Flink; entry != &m_head; entry = entry->Flink)
+		{
+			KProfiledLockBase* lock = CONTAINING_RECORD(entry, KProfiledLockBase, m_entry);
+
+			KLockStats stats;
+			lock->GetStats(&stats);
+			func(lock->GetName(), stats);
+		}
+	}
+
+private:
+	void Link(__in KProfiledLockBase* lock)
+	{
+		KLocker<KSpinLock> locker(m_lock);
+		InsertTailList(&m_head, &lock->m_entry);
+	}
+
+	void Unlink(__in KProfiledLockBase* lock)
+	{
+		KLocker<KSpinLock> locker(m_lock);
+		RemoveEntryList(&lock->m_entry);
+	}
+
+private:
+	KSpinLock m_lock;
+	LIST_ENTRY m_head;
+};
+
+inline void KProfiledLockBase::Register(__in KLockProfileRegistry& registry, __in PCSTR name)
+{
+	ASSERT(!m_registry);
+
+	m_name = name;
+	m_registry = &registry;
+	m_registry->Link(this);
+}
+
+inline KProfiledLockBase::~KProfiledLockBase()
+{
+	if (m_registry)
+		m_registry->Unlink(this);
+
+	delete[] m_buffer;
+}
+
+// Tells reader-writer locks apart, so that the profiled lock takes the same kind of base as the one wrapped.
+template <typename T> struct IsRWLock
+{
+	static SfinaeTypes::Two Test(KRWLock<T>*);
+	static SfinaeTypes::One Test(...);
+
+	static const bool value = sizeof(Test(static_cast<T*>(NULL))) == sizeof(SfinaeTypes::Two);
+};
+
+// Tells which try-acquires the lock has: TryLock() of KSpinLock, KFastMutex and KGuardedMutex,
+// TryLockExclusive() and TryLockShared() of KResource.
+template <typename T> struct HasTryLock
+{
+	template <typename U, bool (U::*)()> struct Probe {};
+
+	template <typename U> static SfinaeTypes::Two TestPlain(Probe<U, &U::TryLock>*);
+	template <typename U> static SfinaeTypes::One TestPlain(...);
+	template <typename U> static SfinaeTypes::Two TestExclusive(Probe<U, &U::TryLockExclusive>*);
+	template <typename U> static SfinaeTypes::One TestExclusive(...);
+	template <typename U> static SfinaeTypes::Two TestShared(Probe<U, &U::TryLockShared>*);
+	template <typename U> static SfinaeTypes::One TestShared(...);
+
+	static const bool plain = sizeof(TestPlain<T>(NULL)) == sizeof(SfinaeTypes::Two);
+	static const bool exclusive = sizeof(TestExclusive<T>(NULL)) == sizeof(SfinaeTypes::Two);
+	static const bool shared = sizeof(TestShared<T>(NULL)) == sizeof(SfinaeTypes::Two);
+};
+
+// Times the wait of every acquisition and the hold of exclusive ones around the lock wrapped.
+// Exclusive holders are serialized, so the start of the hold is kept in the lock itself.
+// Where the lock has a try-acquire, it is attempted first: a success is recorded as an uncontended
+// acquisition without reading the counter for the wait, a failure as a contended one.
+// KQueuedLock and KRWSpinLock keep acquisition state in their lockers and cannot be wrapped.
+template <typename T> class KProfiledLock
+	: public Conditional< IsRWLock<T>::value, KRWLock< KProfiledLock<T> >, KLock< KProfiledLock<T> > >::type
+	, public KProfiledLockBase
+{
+	CLASS_NO_COPY(KProfiledLock)
+public:
+	explicit KProfiledLock()
+		: m_holdStart(0)
+		, m_exclusive(false)
+	{
+	}
+
+	explicit KProfiledLock(__in KLockProfileRegistry& registry, __in PCSTR name)
+		: m_holdStart(0)
+		, m_exclusive(false)
+	{
+		Register(registry, name);
+	}
+
+	~KProfiledLock() {}
+
+	void Lock()
+	{
+		if (Attempt(CanTry_t()))
+		{
+			OnExclusive();
+			RecordWait(0, false);
+			return;
+		}
+
+		LONG64 start = Now();
+		m_lock.Lock();
+		OnExclusive();
+		RecordWait(Elapsed(start, m_holdStart), CanTry_t::value);
+	}
+
+	void LockShared()
+	{
+		if (AttemptShared(CanTryShared_t()))
+		{
+			RecordWait(0, false);
+			return;
+		}
+
+		LONG64 start = Now();
+		m_lock.LockShared();
+		RecordWait(Elapsed(start, Now()), CanTryShared_t::value);
+	}
+
+	void LockExclusive()
+	{
+		if (AttemptExclusive(CanTryExclusive_t()))
+		{
+			OnExclusive();
+			RecordWait(0, false);
+			return;
+		}
+
+		LONG64 start = Now();
+		m_lock.LockExclusive();
+		OnExclusive();
+		RecordWait(Elapsed(start, m_holdStart), CanTryExclusive_t::value);
+	}
+
+	// Counters are updated after the release, so that profiling does not prolong the hold.
+	void Unlock()
+	{
+		if (!m_exclusive)
+		{
+			m_lock.Unlock();
+			return;
+		}
+
+		LONG64 hold = Now() - m_holdStart;
+		m_exclusive = false;
+
+		m_lock.Unlock();
+		RecordHold(hold);
+	}
+
+private:
+	typedef IntegralConstant<bool, HasTryLock<T>::plain> CanTry_t;
+	typedef IntegralConstant<bool, HasTryLock<T>::exclusive> CanTryExclusive_t;
+	typedef IntegralConstant<bool, HasTryLock<T>::shared> CanTryShared_t;
+
+private:
+	void OnExclusive()
+	{
+		m_holdStart = Now();
+		m_exclusive = true;
+	}
+
+	bool Attempt(__in true_type)
+	{
+		return m_lock.TryLock();
+	}
+
+	bool Attempt(__in false_type)
+	{
+		return false;
+	}
+
+	bool AttemptExclusive(__in true_type)
+	{
+		return m_lock.TryLockExclusive();
+	}
+
+	bool AttemptExclusive(__in false_type)
+	{
+		return false;
+	}
+
+	bool AttemptShared(__in true_type)
+	{
+		return m_lock.TryLockShared();
+	}
+
+	bool AttemptShared(__in false_type)
+	{
+		return false;
+	}
+
+private:
+	T m_lock;
+	LONG64 m_holdStart;
+	volatile bool m_exclusive;
+};
+
+#else // LOCK_PROFILING
+
+class KLockProfileRegistry
+{
+	CLASS_NO_COPY(KLockProfileRegistry)
+public:
+	explicit KLockProfileRegistry() {}
+	~KLockProfileRegistry() {}
+
+	template <typename Func> void ForEach(__in Func&) {}
+};
+
+// Bare lock. Profiling calls compile to nothing.
+template <typename T> class KProfiledLock : public T
+{
+	CLASS_NO_COPY(KProfiledLock)
+public:
+	explicit KProfiledLock() {}
+	explicit KProfiledLock(__in KLockProfileRegistry&, __in PCSTR) {}
+	~KProfiledLock() {}
+
+	void Register(__in KLockProfileRegistry&, __in PCSTR) {}
+
+	PCSTR GetName() const
+	{
+		return NULL;
+	}
+
+	void GetStats(__out KLockStats* stats)
+	{
+		*stats = KLockStats();
+	}
+};
+
+#endif // LOCK_PROFILING
\ No newline at end of file
@@ -18,6 +18,19 @@ public:
 	KQueue()
 	{}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	KQueue(KQueue&& other)
+		: m_holder(::Move(other.m_holder))
+	{
+	}
+
+	KQueue& operator = (KQueue&& other)
+	{
+		m_holder = ::Move(other.m_holder);
+		return *this;
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
 	void Cleanup()
 	{
 		m_holder.Cleanup();
@@ -38,6 +51,13 @@ public:
 		m_holder.InsertLast(entry);
 	}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	void Push(Val_t&& entry)
+	{
+		m_holder.InsertLast(::Move(entry));
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
 	Val_t Pop()
 	{
 		return m_holder.RemoveFirst();
@@ -0,0 +1,983 @@
+#pragma once
+
+#include "CommonDefinitions.h"
+#include "Synch.h"
+#include "Allocator.h"
+#include "Wildcard.h"
+
+// Compressed radix tree mapping path rules to values. Every edge is labelled with a run of characters,
+// so a path is matched against the rules in a single pass of O(path length) comparisons whatever
+// the number of rules. Comparison is case-insensitive: labels are kept upcased and the path is upcased
+// character by character while descending, either through the caller's upcase table of 65536 entries,
+// e.g. the one of the volume, or through RtlUpcaseUnicodeChar beyond ASCII.
+//
+// A rule is either a literal path prefix or a pattern containing '*' or '?'. Literal rule matches a path
+// which continues with a separator after it or ends there, so "\Windows" covers "\Windows\System32" but
+// not "\WindowsApps". Pattern rule is stored at the node of its literal part and the rest of it is handed
+// to wildcard_fast() for the rest of the path, where '*' crosses separators as well. The deepest match wins.
+//
+// Wildcard matching allocates from the paged pool for long patterns and takes several kilobytes of stack,
+// thus lookups are meant for IRQL below DISPATCH_LEVEL.
+template <typename T, typename Lock, typename Alloc> class KRadixTree
+{
+	CLASS_NO_COPY(KRadixTree)
+public:
+	typedef T Mapped_t;
+	typedef size_t Size_t;
+
+	// Item of the rule list passed to BuildFromSorted().
+	struct Rule_t
+	{
+		UNICODE_STRING path;
+		Mapped_t value;
+	};
+
+	explicit KRadixTree(__in_opt PCWCH upcaseTable = NULL)
+		: m_upcaseTable(upcaseTable)
+		, m_count(0)
+	{
+	}
+
+	~KRadixTree()
+	{
+		Cleanup();
+	}
+
+	// Fails if the very same rule is already present.
+	__checkReturn_opt
+	bool Insert(__in PCUNICODE_STRING rule, __in const Mapped_t& val)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		return LockedInsert(rule, val);
+	}
+
+	// Builds the tree out of rules sorted by their literal parts in upcased code unit order. Every node
+	// is allocated once with its final label and children array, so nothing is split or moved. Unless
+	// the tree is empty and rules are sorted they are inserted one by one instead. Returns false if some rule
+	// could not be inserted. The fast path leaves the tree empty then.
+	__checkReturn_opt
+	bool BuildFromSorted(__in const Rule_t* rules, __in Size_t count)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+
+		bool sorted = true;
+		for (Size_t i = 1; i < count; i++)
+		{
+			if (CompareLiterals(&rules[i - 1].path, &rules[i].path) > 0)
+				sorted = false;
+		}
+
+		if (!sorted || m_count || m_root.childCount)
+		{
+			bool res = true;
+			for (Size_t i = 0; i < count; i++)
+			{
+				if (!LockedInsert(&rules[i].path, rules[i].value))
+					res = false;
+			}
+
+			return res;
+		}
+
+		if (!LockedBuild(rules, count))
+		{
+			LockedCleanup();
+			return false;
+		}
+
+		return true;
+	}
+
+	// Erases the very rule which has been inserted, pattern rules included.
+	__checkReturn_opt
+	bool Erase(__in PCUNICODE_STRING rule)
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+
+		Path_t path;
+		if (!LockedLocate(rule, &path))
+			return false;
+
+		NodePtr_t node = path.node;
+		USHORT literalLength = GetLiteralLength(rule);
+		if (literalLength == GetLength(rule))
+		{
+			if (!node->hasValue)
+				return false;
+
+			node->hasValue = false;
+			node->value = Mapped_t();
+		}
+		else
+		{
+			WildcardPtr_t* link = FindWildcard(node, rule, literalLength);
+			if (!*link)
+				return false;
+
+			WildcardPtr_t wildcard = *link;
+			*link = wildcard->next;
+			FreeWildcard(wildcard);
+		}
+
+		m_count--;
+		Prune(&path);
+
+		return true;
+	}
+
+	// Looks the very rule up rather than matching a path against the rules.
+	__checkReturn
+	bool Find(__in PCUNICODE_STRING rule, __out_opt Mapped_t* val = NULL)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+
+		Path_t path;
+		if (!LockedLocate(rule, &path))
+			return false;
+
+		USHORT literalLength = GetLiteralLength(rule);
+		if (literalLength == GetLength(rule))
+		{
+			if (!path.node->hasValue)
+				return false;
+
+			if (val)
+				*val = path.node->value;
+
+			return true;
+		}
+
+		WildcardPtr_t wildcard = *FindWildcard(path.node, rule, literalLength);
+		if (!wildcard)
+			return false;
+
+		if (val)
+			*val = wildcard->value;
+
+		return true;
+	}
+
+	// Finds the most specific rule matching the path, i.e. the one ending deepest in the tree. Optionally
+	// returns the number of characters matched, which is the whole path for pattern rules.
+	__checkReturn
+	bool FindLongestPrefix(__in PCUNICODE_STRING path, __out_opt Mapped_t* val = NULL, __out_opt USHORT* matchedLength = NULL)
+	{
+		KSharedLocker<Lock> locker(m_lock);
+
+		PCWCH text = GetBuffer(path);
+		USHORT length = GetLength(path);
+		const Mapped_t* best = NULL;
+		USHORT bestLength = 0;
+		NodePtr_t node = &m_root;
+		USHORT pos = 0;
+
+		for (;;)
+		{
+			if (node->hasValue && IsBoundary(text, length, pos))
+			{
+				best = &node->value;
+				bestLength = pos;
+			}
+
+			for (WildcardPtr_t wildcard = node->wildcards; wildcard; wildcard = wildcard->next)
+			{
+				if (MatchWildcard(wildcard, text + pos, text + length))
+				{
+					best = &wildcard->value;
+					bestLength = length;
+					break;
+				}
+			}
+
+			if (pos == length)
+				break;
+
+			NodePtr_t child = FindChild(node, Upcase(text[pos]), NULL);
+			if (!child || (MatchLabel(child, text + pos, static_cast<USHORT>(length - pos)) != child->labelLength))
+				break;
+
+			pos = static_cast<USHORT>(pos + child->labelLength);
+			node = child;
+		}
+
+		if (!best)
+			return false;
+
+		if (val)
+			*val = *best;
+
+		if (matchedLength)
+			*matchedLength = bestLength;
+
+		return true;
+	}
+
+	Size_t GetCount()
+	{
+		KSharedLocker<Lock> locker(m_lock);
+		return m_count;
+	}
+
+	bool IsEmpty()
+	{
+		return GetCount() == 0;
+	}
+
+	void Cleanup()
+	{
+		KExclusiveLocker<Lock> locker(m_lock);
+		LockedCleanup();
+	}
+
+	Lock& GetLock()
+	{
+		return m_lock;
+	}
+
+private:
+	struct Wildcard_t
+	{
+		Wildcard_t* next;
+		Mapped_t value;
+		USHORT patternLength;
+		PWCH pattern;
+
+		Wildcard_t()
+			: next(NULL)
+			, value()
+			, patternLength(0)
+			, pattern(NULL)
+		{
+		}
+
+		~Wildcard_t() {}
+	};
+
+	typedef Wildcard_t* WildcardPtr_t;
+
+	// Label is allocated together with the node right after it. Splitting the node moves the label
+	// pointer forward within the same allocation. Children are sorted by the first character of their labels.
+	struct Node_t
+	{
+		PWCH label;
+		USHORT labelLength;
+		bool hasValue;
+		ULONG childCount;
+		ULONG childCapacity;
+		Node_t** children;
+		WildcardPtr_t wildcards;
+		Mapped_t value;
+
+		Node_t()
+			: label(NULL)
+			, labelLength(0)
+			, hasValue(false)
+			, childCount(0)
+			, childCapacity(0)
+			, children(NULL)
+			, wildcards(NULL)
+			, value()
+		{
+		}
+
+		~Node_t() {}
+	};
+
+	typedef Node_t* NodePtr_t;
+
+	// Node located along with its parent and grandparent, which are NULL above the root.
+	struct Path_t
+	{
+		NodePtr_t node;
+		NodePtr_t parent;
+		NodePtr_t grandparent;
+
+		Path_t()
+			: node(NULL)
+			, parent(NULL)
+			, grandparent(NULL)
+		{
+		}
+	};
+
+	// Pending subtree of BuildFromSorted(): rules sharing the first depth characters and the slot to link it to.
+	struct Frame_t
+	{
+		NodePtr_t* slot;
+		Size_t first;
+		Size_t last;
+		USHORT depth;
+	};
+
+	// Text iterator upcasing characters on the fly, so wildcard_fast() compares the path case-insensitively.
+	class UpcaseIter_t
+	{
+	public:
+		UpcaseIter_t(PCWCH current = NULL, const KRadixTree* tree = NULL)
+			: m_current(current)
+			, m_tree(tree)
+		{
+		}
+
+		WCHAR operator * () const
+		{
+			return m_tree->Upcase(*m_current);
+		}
+
+		UpcaseIter_t& operator++()
+		{
+			m_current++;
+			return *this;
+		}
+
+		UpcaseIter_t operator++(int)
+		{
+			UpcaseIter_t tmp(*this);
+			m_current++;
+			return tmp;
+		}
+
+		bool operator == (const UpcaseIter_t& other) const
+		{
+			return m_current == other.m_current;
+		}
+
+		bool operator != (const UpcaseIter_t& other) const
+		{
+			return m_current != other.m_current;
+		}
+
+	private:
+		PCWCH m_current;
+		const KRadixTree* m_tree;
+	};
+
+	typedef typename Alloc::template Rebind_t<Node_t>::Other_t NodeAlloc_t;
+	typedef typename Alloc::template Rebind_t<NodePtr_t>::Other_t ChildAlloc_t;
+	typedef typename Alloc::template Rebind_t<Wildcard_t>::Other_t WildcardAlloc_t;
+	typedef typename Alloc::template Rebind_t<Frame_t>::Other_t FrameAlloc_t;
+
+	static const ULONG s_initialChildCapacity = 2;
+
+private:
+	WCHAR Upcase(__in WCHAR c) const
+	{
+		if (m_upcaseTable)
+			return m_upcaseTable[c];
+
+		if (c < L'a')
+			return c;
+
+		if (c <= L'z')
+			return c - (L'a' - L'A');
+
+		if (c < 0x80)
+			return c;
+
+		return RtlUpcaseUnicodeChar(c);
+	}
+
+	static PCWCH GetBuffer(__in PCUNICODE_STRING str)
+	{
+		return (str->Buffer) ? str->Buffer : L"";
+	}
+
+	static USHORT GetLength(__in PCUNICODE_STRING str)
+	{
+		return static_cast<USHORT>(str->Length / sizeof(WCHAR));
+	}
+
+	static bool IsWildcard(__in WCHAR c)
+	{
+		return (c == L'*') || (c == L'?');
+	}
+
+	static USHORT GetLiteralLength(__in PCUNICODE_STRING rule)
+	{
+		PCWCH text = GetBuffer(rule);
+		USHORT length = GetLength(rule);
+		USHORT i = 0;
+		while ((i < length) && !IsWildcard(text[i]))
+			i++;
+
+		return i;
+	}
+
+	// Literal rule ending with a separator covers everything below it, and the empty one covers every path.
+	static bool IsBoundary(__in PCWCH text, __in USHORT length, __in USHORT pos)
+	{
+		return (pos == 0) || (pos == length) || (text[pos] == L'\\') || (text[pos - 1] == L'\\');
+	}
+
+	LONG CompareLiterals(__in PCUNICODE_STRING x, __in PCUNICODE_STRING y) const
+	{
+		PCWCH xText = GetBuffer(x);
+		PCWCH yText = GetBuffer(y);
+		USHORT xLength = GetLiteralLength(x);
+		USHORT yLength = GetLiteralLength(y);
+
+		for (USHORT i = 0; (i < xLength) && (i < yLength); i++)
+		{
+			WCHAR xChar = Upcase(xText[i]);
+			WCHAR yChar = Upcase(yText[i]);
+			if (xChar != yChar)
+				return (xChar < yChar) ? -1 : 1;
+		}
+
+		return static_cast<LONG>(xLength) - static_cast<LONG>(yLength);
+	}
+
+	// Number of leading characters of the label matching the text.
+	USHORT MatchLabel(__in NodePtr_t node, __in PCWCH text, __in USHORT length) const
+	{
+		USHORT i = 0;
+		while ((i < node->labelLength) && (i < length) && (node->label[i] == Upcase(text[i])))
+			i++;
+
+		return i;
+	}
+
+	bool MatchWildcard(__in WildcardPtr_t wildcard, __in PCWCH first, __in PCWCH last) const
+	{
+		return wildcard_fast(static_cast<PCWCH>(wildcard->pattern), static_cast<PCWCH>(wildcard->pattern + wildcard->patternLength),
+			UpcaseIter_t(first, this), UpcaseIter_t(last, this)) != UpcaseIter_t();
+	}
+
+	// Binary search over the first characters of child labels. Index receives the position of the child
+	// or the one where it should be inserted.
+	NodePtr_t FindChild(__in NodePtr_t node, __in WCHAR c, __out_opt ULONG* index) const
+	{
+		ULONG low = 0;
+		ULONG high = node->childCount;
+		while (low < high)
+		{
+			ULONG middle = low + (high - low) / 2;
+			WCHAR first = node->children[middle]->label[0];
+			if (first == c)
+			{
+				if (index)
+					*index = middle;
+
+				return node->children[middle];
+			}
+
+			if (first < c)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+
+		if (index)
+			*index = low;
+
+		return NULL;
+	}
+
+	// Caller must hold the lock. Descends along the literal part of the rule, which must end exactly at a node.
+	__checkReturn
+	bool LockedLocate(__in PCUNICODE_STRING rule, __out Path_t* path)
+	{
+		PCWCH text = GetBuffer(rule);
+		USHORT length = GetLiteralLength(rule);
+		USHORT pos = 0;
+
+		path->node = &m_root;
+		while (pos < length)
+		{
+			NodePtr_t child = FindChild(path->node, Upcase(text[pos]), NULL);
+			if (!child || (child->labelLength > length - pos) || (MatchLabel(child, text + pos, static_cast<USHORT>(length - pos)) != child->labelLength))
+				return false;
+
+			pos = static_cast<USHORT>(pos + child->labelLength);
+			path->grandparent = path->parent;
+			path->parent = path->node;
+			path->node = child;
+		}
+
+		return true;
+	}
+
+	// Link to the wildcard holding the pattern part of the rule or to the terminating NULL.
+	WildcardPtr_t* FindWildcard(__in NodePtr_t node, __in PCUNICODE_STRING rule, __in USHORT literalLength)
+	{
+		WildcardPtr_t* link = &node->wildcards;
+		for (; *link; link = &(*link)->next)
+		{
+			if (IsSamePattern(*link, GetBuffer(rule) + literalLength, static_cast<USHORT>(GetLength(rule) - literalLength)))
+				break;
+		}
+
+		return link;
+	}
+
+	bool IsSamePattern(__in WildcardPtr_t wildcard, __in PCWCH text, __in USHORT length) const
+	{
+		USHORT j = 0;
+		for (USHORT i = 0; i < length; i++)
+		{
+			if (text[i] == L'\\')
+			{
+				if ((j == wildcard->patternLength) || (wildcard->pattern[j++] != L'\\'))
+					return false;
+			}
+
+			if ((j == wildcard->patternLength) || (wildcard->pattern[j++] != Upcase(text[i])))
+				return false;
+		}
+
+		return j == wildcard->patternLength;
+	}
+
+	// Caller must hold the lock exclusively.
+	__checkReturn
+	bool LockedInsert(__in PCUNICODE_STRING rule, __in const Mapped_t& val)
+	{
+		USHORT literalLength = GetLiteralLength(rule);
+		NodePtr_t node = LockedInsertPath(GetBuffer(rule), literalLength);
+		if (!node)
+			return false;
+
+		if (literalLength == GetLength(rule))
+		{
+			if (node->hasValue)
+				return false;
+
+			node->hasValue = true;
+			node->value = val;
+		}
+		else
+		{
+			WildcardPtr_t* link = FindWildcard(node, rule, literalLength);
+			if (*link)
+				return false;
+
+			WildcardPtr_t wildcard = AllocateWildcard(GetBuffer(rule) + literalLength, static_cast<USHORT>(GetLength(rule) - literalLength), val);
+			if (!wildcard)
+				return false;
+
+			*link = wildcard;
+		}
+
+		m_count++;
+		return true;
+	}
+
+	// Caller must hold the lock exclusively. Returns the node ending exactly at the given length, splitting
+	// the edge where the key diverges from it and creating the missing tail. Nodes created before an allocation
+	// failure stay empty in the tree, which does not affect lookups.
+	__checkReturn
+	NodePtr_t LockedInsertPath(__in PCWCH key, __in USHORT length)
+	{
+		NodePtr_t node = &m_root;
+		USHORT pos = 0;
+
+		while (pos < length)
+		{
+			ULONG index = 0;
+			NodePtr_t child = FindChild(node, Upcase(key[pos]), &index);
+			if (!child)
+			{
+				child = AllocateNode(key + pos, static_cast<USHORT>(length - pos));
+				if (!child)
+					return NULL;
+
+				if (!InsertChild(node, index, child))
+				{
+					FreeNode(child);
+					return NULL;
+				}
+
+				return child;
+			}
+
+			USHORT common = MatchLabel(child, key + pos, static_cast<USHORT>(length - pos));
+			if (common < child->labelLength)
+			{
+				NodePtr_t middle = AllocateNode(child->label, common);
+				if (!middle)
+					return NULL;
+
+				if (!InsertChild(middle, 0, child))
+				{
+					FreeNode(middle);
+					return NULL;
+				}
+
+				child->label += common;
+				child->labelLength = static_cast<USHORT>(child->labelLength - common);
+				node->children[index] = middle;
+				child = middle;
+			}
+
+			pos = static_cast<USHORT>(pos + common);
+			node = child;
+		}
+
+		return node;
+	}
+
+	// Caller must hold the lock exclusively. Depth first over ranges of rules sharing a prefix. The range
+	// is sorted, so its common prefix is that of its first and last rules, the rules ending right there come
+	// first and the rest fall into consecutive groups by the next character, one group per child.
+	// Pending ranges are kept in an explicit stack, so the kernel stack does not depend on the tree depth.
+	__checkReturn
+	bool LockedBuild(__in const Rule_t* rules, __in Size_t count)
+	{
+		if (!count)
+			return true;
+
+		// Every frame yields a node with at least one rule below it, so there are fewer than 2 * count of them.
+		FrameAlloc_t frameAllocator;
+		Frame_t* frames = frameAllocator.Allocate(2 * count * sizeof(Frame_t));
+		if (!frames)
+			return false;
+
+		Size_t top = 0;
+		bool res = LockedBuildNode(&m_root, rules, 0, count, 0, frames, &top);
+
+		while (res && top)
+		{
+			Frame_t frame = frames[--top];
+			PCWCH key = GetBuffer(&rules[frame.first].path);
+			USHORT common = CommonLength(&rules[frame.first].path, &rules[frame.last - 1].path);
+
+			NodePtr_t node = AllocateNode(key + frame.depth, static_cast<USHORT>(common - frame.depth));
+			if (!node)
+			{
+				res = false;
+				break;
+			}
+
+			*frame.slot = node;
+			res = LockedBuildNode(node, rules, frame.first, frame.last, common, frames, &top);
+		}
+
+		frameAllocator.Deallocate(frames);
+		return res;
+	}
+
+	// Attaches the rules ending at the node and pushes a frame for every group of the rest.
+	__checkReturn
+	bool LockedBuildNode(__in NodePtr_t node, __in const Rule_t* rules, __in Size_t first, __in Size_t last, __in USHORT depth,
+		__inout Frame_t* frames, __inout Size_t* top)
+	{
+		Size_t i = first;
+		for (; (i < last) && (GetLiteralLength(&rules[i].path) == depth); i++)
+		{
+			PCUNICODE_STRING rule = &rules[i].path;
+			if (GetLength(rule) == depth)
+			{
+				if (node->hasValue)
+					return false;
+
+				node->hasValue = true;
+				node->value = rules[i].value;
+			}
+			else
+			{
+				WildcardPtr_t* link = FindWildcard(node, rule, depth);
+				if (*link)
+					return false;
+
+				*link = AllocateWildcard(GetBuffer(rule) + depth, static_cast<USHORT>(GetLength(rule) - depth), rules[i].value);
+				if (!*link)
+					return false;
+			}
+
+			m_count++;
+		}
+
+		ULONG groups = 0;
+		for (Size_t j = i; j < last; j++)
+		{
+			if ((j == i) || (Upcase(GetBuffer(&rules[j].path)[depth]) != Upcase(GetBuffer(&rules[j - 1].path)[depth])))
+				groups++;
+		}
+
+		if (!groups)
+			return true;
+
+		node->children = m_childAllocator.Allocate(groups * sizeof(NodePtr_t));
+		if (!node->children)
+			return false;
+
+		RtlZeroMemory(node->children, groups * sizeof(NodePtr_t));
+		node->childCapacity = groups;
+		node->childCount = groups;
+
+		// Groups are pushed from the last one, so they are popped in ascending order.
+		Size_t groupLast = last;
+		ULONG group = groups;
+		for (Size_t j = last; j > i; j--)
+		{
+			if ((j - 1 == i) || (Upcase(GetBuffer(&rules[j - 1].path)[depth]) != Upcase(GetBuffer(&rules[j - 2].path)[depth])))
+			{
+				Frame_t& frame = frames[(*top)++];
+				frame.slot = &node->children[--group];
+				frame.first = j - 1;
+				frame.last = groupLast;
+				frame.depth = depth;
+				groupLast = j - 1;
+			}
+		}
+
+		return true;
+	}
+
+	// Length of the common upcased prefix of literal parts.
+	USHORT CommonLength(__in PCUNICODE_STRING x, __in PCUNICODE_STRING y) const
+	{
+		PCWCH xText = GetBuffer(x);
+		PCWCH yText = GetBuffer(y);
+		USHORT xLength = GetLiteralLength(x);
+		USHORT yLength = GetLiteralLength(y);
+		USHORT length = (xLength < yLength) ? xLength : yLength;
+		USHORT i = 0;
+		while ((i < length) && (Upcase(xText[i]) == Upcase(yText[i])))
+			i++;
+
+		return i;
+	}
+
+	__checkReturn
+	bool InsertChild(__in NodePtr_t node, __in ULONG index, __in NodePtr_t child)
+	{
+		if (node->childCount == node->childCapacity)
+		{
+			ULONG capacity = (node->childCapacity) ? (node->childCapacity << 1) : s_initialChildCapacity;
+			NodePtr_t* children = m_childAllocator.Allocate(capacity * sizeof(NodePtr_t));
+			if (!children)
+				return false;
+
+			if (node->childCount)
+				RtlCopyMemory(children, node->children, node->childCount * sizeof(NodePtr_t));
+
+			if (node->children)
+				m_childAllocator.Deallocate(node->children);
+
+			node->children = children;
+			node->childCapacity = capacity;
+		}
+
+		RtlMoveMemory(&node->children[index + 1], &node->children[index], (node->childCount - index) * sizeof(NodePtr_t));
+		node->children[index] = child;
+		node->childCount++;
+
+		return true;
+	}
+
+	void RemoveChild(__in NodePtr_t node, __in NodePtr_t child)
+	{
+		ULONG index = 0;
+		FindChild(node, child->label[0], &index);
+
+		RtlMoveMemory(&node->children[index], &node->children[index + 1], (node->childCount - index - 1) * sizeof(NodePtr_t));
+		node->childCount--;
+	}
+
+	static bool IsUseless(__in NodePtr_t node)
+	{
+		return !node->hasValue && !node->wildcards;
+	}
+
+	// Keeps the tree compressed after erasure. Empty leaf goes away, then its parent is merged with
+	// the only child left if the parent holds no rule. If the merged node cannot be allocated,
+	// the chain stays uncompressed, which costs a node but does not affect lookups.
+	void Prune(__in Path_t* path)
+	{
+		NodePtr_t node = path->node;
+		NodePtr_t parent = path->parent;
+		NodePtr_t grandparent = path->grandparent;
+
+		if (!parent)
+			return;
+
+		if (IsUseless(node) && !node->childCount)
+		{
+			RemoveChild(parent, node);
+			FreeNode(node);
+			node = parent;
+			parent = grandparent;
+		}
+
+		if (!parent || !IsUseless(node) || (node->childCount != 1))
+			return;
+
+		NodePtr_t child = node->children[0];
+		NodePtr_t merged = AllocateNode(NULL, static_cast<USHORT>(node->labelLength + child->labelLength));
+		if (!merged)
+			return;
+
+		RtlCopyMemory(merged->label, node->label, node->labelLength * sizeof(WCHAR));
+		RtlCopyMemory(merged->label + node->labelLength, child->label, child->labelLength * sizeof(WCHAR));
+
+		merged->hasValue = child->hasValue;
+		merged->value = child->value;
+		merged->wildcards = child->wildcards;
+		merged->children = child->children;
+		merged->childCount = child->childCount;
+		merged->childCapacity = child->childCapacity;
+
+		child->wildcards = NULL;
+		child->children = NULL;
+		child->childCount = 0;
+
+		ULONG index = 0;
+		FindChild(parent, node->label[0], &index);
+		parent->children[index] = merged;
+
+		FreeNode(child);
+		FreeNode(node);
+	}
+
+	// Label is copied upcased. NULL text leaves the label for the caller to fill.
+	__checkReturn
+	NodePtr_t AllocateNode(__in_opt PCWCH text, __in USHORT length)
+	{
+		NodePtr_t node = m_nodeAllocator.Allocate(sizeof(Node_t) + length * sizeof(WCHAR));
+		ASSERT(node);
+
+		if (!node)
+			return NULL;
+
+		m_nodeAllocator.Construct(node);
+		node->label = reinterpret_cast<PWCH>(node + 1);
+		node->labelLength = length;
+
+		if (text)
+		{
+			for (USHORT i = 0; i < length; i++)
+				node->label[i] = Upcase(text[i]);
+		}
+
+		return node;
+	}
+
+	// Frees the node alone, its children and wildcards are the caller's business.
+	void FreeNode(__in NodePtr_t node)
+	{
+		if (node->children)
+			m_childAllocator.Deallocate(node->children);
+
+		while (node->wildcards)
+		{
+			WildcardPtr_t next = node->wildcards->next;
+			FreeWildcard(node->wildcards);
+			node->wildcards = next;
+		}
+
+		m_nodeAllocator.Destroy(node);
+		m_nodeAllocator.Deallocate(node);
+	}
+
+	// Pattern is stored upcased with separators escaped, since wildcard_fast() treats backslash as escape.
+	__checkReturn
+	WildcardPtr_t AllocateWildcard(__in PCWCH text, __in USHORT length, __in const Mapped_t& val)
+	{
+		USHORT patternLength = length;
+		for (USHORT i = 0; i < length; i++)
+		{
+			if (text[i] == L'\\')
+				patternLength++;
+		}
+
+		WildcardPtr_t wildcard = m_wildcardAllocator.Allocate(sizeof(Wildcard_t) + patternLength * sizeof(WCHAR));
+		ASSERT(wildcard);
+
+		if (!wildcard)
+			return NULL;
+
+		m_wildcardAllocator.Construct(wildcard);
+		wildcard->value = val;
+		wildcard->pattern = reinterpret_cast<PWCH>(wildcard + 1);
+		wildcard->patternLength = patternLength;
+
+		USHORT j = 0;
+		for (USHORT i = 0; i < length; i++)
+		{
+			if (text[i] == L'\\')
+				wildcard->pattern[j++] = L'\\';
+
+			wildcard->pattern[j++] = Upcase(text[i]);
+		}
+
+		return wildcard;
+	}
+
+	void FreeWildcard(__in WildcardPtr_t wildcard)
+	{
+		m_wildcardAllocator.Destroy(wildcard);
+		m_wildcardAllocator.Deallocate(wildcard);
+	}
+
+	// Caller must hold the lock exclusively. Frees the tree without recursion. Nodes waiting to be freed
+	// are chained through their label pointers, which are of no use any more.
+	void LockedCleanup()
+	{
+		NodePtr_t pending = NULL;
+		for (ULONG i = 0; i < m_root.childCount; i++)
+		{
+			NodePtr_t child = m_root.children[i];
+			if (child)
+			{
+				child->label = reinterpret_cast<PWCH>(pending);
+				pending = child;
+			}
+		}
+
+		while (pending)
+		{
+			NodePtr_t node = pending;
+			pending = reinterpret_cast<NodePtr_t>(node->label);
+
+			for (ULONG i = 0; i < node->childCount; i++)
+			{
+				NodePtr_t child = node->children[i];
+				if (child)
+				{
+					child->label = reinterpret_cast<PWCH>(pending);
+					pending = child;
+				}
+			}
+
+			FreeNode(node);
+		}
+
+		if (m_root.children)
+			m_childAllocator.Deallocate(m_root.children);
+
+		while (m_root.wildcards)
+		{
+			WildcardPtr_t next = m_root.wildcards->next;
+			FreeWildcard(m_root.wildcards);
+			m_root.wildcards = next;
+		}
+
+		m_root.children = NULL;
+		m_root.childCount = 0;
+		m_root.childCapacity = 0;
+		m_root.hasValue = false;
+		m_root.value = Mapped_t();
+		m_count = 0;
+	}
+
+private:
+	Lock m_lock;
+	PCWCH m_upcaseTable;
+	NodeAlloc_t m_nodeAllocator;
+	ChildAlloc_t m_childAllocator;
+	WildcardAlloc_t m_wildcardAllocator;
+	Node_t m_root;
+	Size_t m_count;
+};
+
+// Only paged pool flavours are offered, since wildcard matching needs IRQL below DISPATCH_LEVEL anyway.
+template <typename T> struct KPagedPoolRadixTree
+{
+	typedef KRadixTree< T, KGuardedMutex, typename KPagedPoolAllocator< T >::Type > Type;
+};
+
+template <typename T, ULONG Tag> struct KTaggedPagedPoolRadixTree
+{
+	typedef KRadixTree< T, KGuardedMutex, typename KTaggedPagedPoolAllocator< T, Tag >::Type > Type;
+};
\ No newline at end of file
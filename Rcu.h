@@ -0,0 +1,241 @@
+#pragma once
+
+#include "CommonDefinitions.h"
+#include "KernelNew.h"
+#include "Synch.h"
+#include "Utility.h"
+#include "Processor.h"
+
+// Pointer to an object which is replaced as a whole and read concurrently without locks.
+// Readers enter a read-side section by bumping a counter of the current processor, so they never
+// wait for anybody and neither share a cache line with readers running on other processors.
+// Writers publish a new object with an atomic exchange and then wait for a grace period, i.e. until
+// every section which might have seen the old object is over, and only then destroy the old object.
+//
+// Sections are counted in two generations selected by the epoch. A writer flips the epoch and waits
+// for the previous generation to drain, so readers arriving all the time cannot delay it forever.
+// The other generation is drained before the flip as well, since a reader which fetched the epoch
+// right before the previous flip may still be counted there.
+//
+// Read-side sections may be entered at IRQL <= DISPATCH_LEVEL and nest. At DISPATCH_LEVEL the object
+// and this class must live in nonpaged memory. Writers run at PASSIVE_LEVEL and block for the grace period.
+template <typename T, typename Deleter = KDefaultDelete<T> > class KRcuPtr
+{
+	CLASS_NO_COPY(KRcuPtr)
+public:
+	// Read-side section. The object it refers to stays alive at least as long as the section.
+	class Reference_t
+	{
+		CLASS_NO_COPY(Reference_t)
+	public:
+		explicit Reference_t(KRcuPtr& target)
+			: m_target(target)
+			, m_slot(0)
+			, m_generation(0)
+			, m_obj(NULL)
+		{
+			m_obj = m_target.ReadLock(&m_slot, &m_generation);
+		}
+
+		~Reference_t()
+		{
+			m_target.ReadUnlock(m_slot, m_generation);
+		}
+
+		T* Get() const
+		{
+			return m_obj;
+		}
+
+		T* operator -> () const
+		{
+			return m_obj;
+		}
+
+		T& operator * () const
+		{
+			return *m_obj;
+		}
+
+		bool IsValid() const
+		{
+			return m_obj != NULL;
+		}
+
+	private:
+		KRcuPtr& m_target;
+		ULONG m_slot;
+		ULONG m_generation;
+		T* m_obj;
+	};
+
+	__drv_maxIRQL(PASSIVE_LEVEL)
+	explicit KRcuPtr(__in_opt T* obj = NULL)
+		: m_obj(obj)
+		, m_epoch(0)
+		, m_buffer(NULL)
+		, m_slots(NULL)
+		, m_slotCount(1)
+	{
+		// Pool does not align small allocations to the cache line, so an extra line leaves room for that.
+		ULONG count = GetProcessorCount();
+		SIZE_T size = count * sizeof(Slot_t) + SYSTEM_CACHE_ALIGNMENT_SIZE;
+		m_buffer = new (NonPagedPool) UCHAR[size];
+
+		// Single shared counter still works, it just makes readers contend.
+		if (!m_buffer)
+		{
+			m_slots = &m_fallback;
+			return;
+		}
+
+		RtlZeroMemory(m_buffer, size);
+
+		ULONG_PTR aligned = (reinterpret_cast<ULONG_PTR>(m_buffer) + SYSTEM_CACHE_ALIGNMENT_SIZE - 1) & ~static_cast<ULONG_PTR>(SYSTEM_CACHE_ALIGNMENT_SIZE - 1);
+		m_slots = reinterpret_cast<Slot_t*>(aligned);
+		m_slotCount = count;
+	}
+
+	// Caller guarantees there are no readers anymore.
+	__drv_maxIRQL(PASSIVE_LEVEL)
+	~KRcuPtr()
+	{
+		if (m_obj)
+			m_deleter(m_obj);
+
+		delete[] m_buffer;
+	}
+
+	// Replaces the object and destroys the previous one once no reader can see it anymore.
+	__drv_maxIRQL(PASSIVE_LEVEL)
+	void Publish(__in_opt T* obj)
+	{
+		KLocker<KGuardedMutex> locker(m_writerLock);
+
+		T* old = static_cast<T*>(InterlockedExchangePointer(reinterpret_cast<volatile PVOID*>(&m_obj), obj));
+		LockedSynchronize();
+
+		if (old)
+			m_deleter(old);
+	}
+
+	// Waits until every read-side section entered before the call is over.
+	__drv_maxIRQL(PASSIVE_LEVEL)
+	void Synchronize()
+	{
+		KLocker<KGuardedMutex> locker(m_writerLock);
+		LockedSynchronize();
+	}
+
+private:
+	struct DECLSPEC_CACHEALIGN Slot_t
+	{
+		volatile LONG readers[2];
+
+		Slot_t()
+		{
+			readers[0] = 0;
+			readers[1] = 0;
+		}
+	};
+
+private:
+	// Caller must hold the writer lock, so that epoch flips of different writers do not interleave.
+	void LockedSynchronize()
+	{
+		ULONG generation = static_cast<ULONG>(m_epoch) & 1;
+		WaitForReaders(generation ^ 1);
+
+		InterlockedIncrement(&m_epoch);
+		WaitForReaders(generation);
+	}
+
+	// Interlocked increment is a full barrier, so the object is fetched only after the section
+	// has become visible to writers.
+	T* ReadLock(__out ULONG* slot, __out ULONG* generation)
+	{
+		*slot = GetCurrentProcessorIndex() % m_slotCount;
+		*generation = static_cast<ULONG>(m_epoch) & 1;
+		InterlockedIncrement(&m_slots[*slot].readers[*generation]);
+
+		return m_obj;
+	}
+
+	// The reader might have moved to another processor, so the counter it bumped is decremented.
+	void ReadUnlock(__in ULONG slot, __in ULONG generation)
+	{
+		InterlockedDecrement(&m_slots[slot].readers[generation]);
+	}
+
+	// A reader keeps its counter above zero for the whole section, so a section in progress cannot be
+	// missed even though the counters are not read at once.
+	void WaitForReaders(__in ULONG generation)
+	{
+		LARGE_INTEGER interval;
+		interval.QuadPart = -10000; // 1 ms
+
+		for (ULONG i = 0; i < m_slotCount; i++)
+		{
+			while (m_slots[i].readers[generation])
+				KeDelayExecutionThread(KernelMode, FALSE, &interval);
+		}
+
+		KeMemoryBarrier();
+	}
+
+private:
+	T* volatile m_obj;
+	volatile LONG m_epoch;
+	PUCHAR m_buffer;
+	Slot_t* m_slots;
+	ULONG m_slotCount;
+	Slot_t m_fallback;
+	KGuardedMutex m_writerLock;
+	Deleter m_deleter;
+};
+
+// Lookup table replaced as a whole. Writers build a new table, e.g. KFlatMap frozen before publication
+// or KMap with KNullLock, and hand it over to Publish(). Readers look it up through the helpers below
+// or hold Reference_t for a series of lookups against the same version of the table.
+template <typename Table, typename Deleter = KDefaultDelete<Table> > class KPublishedTable
+: public KRcuPtr<Table, Deleter>
+{
+	CLASS_NO_COPY(KPublishedTable)
+
+	typedef KRcuPtr<Table, Deleter> Base_t;
+public:
+	typedef typename Table::Key_t Key_t;
+	typedef typename Base_t::Reference_t Reference_t;
+
+	__drv_maxIRQL(PASSIVE_LEVEL)
+	explicit KPublishedTable(__in_opt Table* table = NULL)
+		: Base_t(table)
+	{
+	}
+
+	~KPublishedTable() {}
+
+	__checkReturn
+	bool Contains(__in const Key_t& key)
+	{
+		Reference_t table(*this);
+		return table.IsValid() && table->Contains(key);
+	}
+
+	// Mapped value is copied out since the table may be destroyed as soon as the section is over.
+	template <typename Mapped>
+	__checkReturn
+	bool Find(__in const Key_t& key, __out Mapped* val)
+	{
+		Reference_t table(*this);
+		if (!table.IsValid())
+			return false;
+
+		typename Table::Iter_t it = table->Find(key);
+		if (it == table->End())
+			return false;
+
+		*val = it->second;
+		return true;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "CommonDefinitions.h"
+#include "TypeTraits.h"
+#include "Utility.h"
+
+// Default policy calling reference counting methods of the object itself.
+template <typename Type> struct KRefTraits
+{
+	static void AddRef(__in Type* obj)
+	{
+		obj->AddRef();
+	}
+
+	static void Release(__in Type* obj)
+	{
+		obj->Release();
+	}
+};
+
+// Policy for objects of the object manager, such as threads, processes, events or file objects.
+template <typename Type> struct KObjectRefTraits
+{
+	static void AddRef(__in Type* obj)
+	{
+		ObReferenceObject(obj);
+	}
+
+	__drv_maxIRQL(DISPATCH_LEVEL)
+	static void Release(__in Type* obj)
+	{
+		ObDereferenceObject(obj);
+	}
+};
+
+// Smart pointer to an object counting references by itself. The pointer is all the handle consists of,
+// so it is as cheap to store and pass as a raw one. Counting is delegated to the traits, so any object
+// may be held once there is a policy for it.
+template <typename Type, typename Traits = KRefTraits<Type> > class KRefPtr
+{
+	Type* m_obj;
+
+	template <typename OtherType, typename OtherTraits> friend class KRefPtr;
+
+public:
+	// Takes a reference of its own, so the object stays referenced by the caller as well.
+	explicit KRefPtr(__in_opt Type* obj = NULL)
+		: m_obj(obj)
+	{
+		if (m_obj)
+			Traits::AddRef(m_obj);
+	}
+
+	KRefPtr(const KRefPtr& other)
+		: m_obj(other.m_obj)
+	{
+		if (m_obj)
+			Traits::AddRef(m_obj);
+	}
+
+	template <typename OtherType, typename OtherTraits> KRefPtr(const KRefPtr<OtherType, OtherTraits>& other)
+		: m_obj(other.m_obj)
+	{
+		if (m_obj)
+			Traits::AddRef(m_obj);
+	}
+
+	~KRefPtr()
+	{
+		if (m_obj)
+			Traits::Release(m_obj);
+	}
+
+	// Reference of the other pointer is taken before the own one is released, so self-assignment is harmless.
+	KRefPtr& operator = (const KRefPtr& other)
+	{
+		Reset(other.m_obj);
+		return *this;
+	}
+
+	template <typename OtherType, typename OtherTraits> KRefPtr& operator = (const KRefPtr<OtherType, OtherTraits>& other)
+	{
+		Reset(other.m_obj);
+		return *this;
+	}
+
+	Type& operator*() const { return *m_obj; }
+
+	Type* operator->() const { return m_obj; }
+
+	operator bool() const { return m_obj != NULL; }
+
+	Type* Get() const { return m_obj; }
+
+	bool operator == (const KRefPtr& other) const
+	{
+		return m_obj == other.m_obj;
+	}
+
+	bool operator != (const KRefPtr& other) const
+	{
+		return m_obj != other.m_obj;
+	}
+
+	void Reset(__in_opt Type* obj = NULL)
+	{
+		if (obj)
+			Traits::AddRef(obj);
+
+		Type* old = m_obj;
+		m_obj = obj;
+
+		if (old)
+			Traits::Release(old);
+	}
+
+	// Adopts the reference the caller holds, e.g. the one returned by ObReferenceObjectByHandle().
+	void Attach(__in_opt Type* obj)
+	{
+		Type* old = m_obj;
+		m_obj = obj;
+
+		if (old)
+			Traits::Release(old);
+	}
+
+	// Hands the reference over to the caller, who becomes responsible for releasing it.
+	Type* Detach()
+	{
+		Type* obj = m_obj;
+		m_obj = NULL;
+		return obj;
+	}
+
+	void Swap(__inout KRefPtr& other)
+	{
+		::Swap(m_obj, other.m_obj);
+	}
+};
+
+// Mixin counting references of the derived class with interlocked operations. The count starts at zero,
+// so the first KRefPtr made of the object owns it. Once the last reference is released the object
+// is destroyed by the deleter.
+template <typename Derived, typename Deleter = KDefaultDelete<Derived> > class KRefCounted
+{
+	CLASS_NO_COPY(KRefCounted)
+public:
+	KRefCounted()
+		: m_refCount(0)
+	{
+	}
+
+	LONG AddRef()
+	{
+		return InterlockedIncrement(&m_refCount);
+	}
+
+	LONG Release()
+	{
+		LONG count = InterlockedDecrement(&m_refCount);
+		ASSERT(count >= 0);
+
+		if (!count)
+		{
+			Deleter deleter;
+			deleter(static_cast<Derived*>(this));
+		}
+
+		return count;
+	}
+
+	// Snapshot only, the count may change as soon as it is read.
+	LONG GetRefCount() const
+	{
+		return m_refCount;
+	}
+
+protected:
+	~KRefCounted() {}
+
+private:
+	volatile LONG m_refCount;
+};
+
+// Referenced thread object, as returned by PsCreateSystemThread() followed by ObReferenceObjectByHandle().
+typedef RemovePointer<PETHREAD>::type KThreadObject_t;
+typedef KRefPtr< KThreadObject_t, KObjectRefTraits<KThreadObject_t> > KThreadRefPtr;
\ No newline at end of file
@@ -1,9 +1,17 @@
 #pragma once
 
 #include "AvlTree.h"
-
-template <typename ConcreteSet, typename T, typename Lock, typename Alloc> class KSet
-: public KAvlTree< ConcreteSet, Lock, Alloc >
+#include "NativeAvlTree.h"
+
+// Tree is the engine storing items, either KAvlTree built on RTL_AVL_TABLE or KNativeAvlTree.
+template
+<
+	typename ConcreteSet,
+	typename T,
+	typename Lock,
+	typename Alloc,
+	typename Tree = KAvlTree< ConcreteSet, Lock, Alloc >
+> class KSet : public Tree
 {
 	CLASS_NO_COPY(KSet)
 public:
@@ -69,6 +77,18 @@ private:
 	ItemAlloc_t m_allocator;
 };
 
+// Set on KNativeAvlTree. The tree allocates and frees nodes itself, so no event sink is needed.
+template <typename T, typename Lock, typename Alloc> class KNativeSet
+: public KSet< KNativeSet<T, Lock, Alloc>, T, Lock, Alloc, KNativeAvlTree< KNativeSet<T, Lock, Alloc>, Lock, Alloc > >
+{
+	CLASS_NO_COPY(KNativeSet)
+
+	friend class KNativeAvlTree< KNativeSet<T, Lock, Alloc>, Lock, Alloc >;
+public:
+	explicit KNativeSet() {}
+	~KNativeSet() {}
+};
+
 template <typename T> struct KPagedPoolSet
 {
 	typedef KPoolSet< T, KGuardedMutex, typename KPagedPoolAllocator< T >::Type > Type;
@@ -97,4 +117,34 @@ template <typename T, ULONG Tag> struct KPagedLookasideSet
 template <typename T, ULONG Tag> struct KNonPagedLookasideSet
 {
 	typedef KLookasideSet< T, KSpinLock, KNonPagedLookasideAllocator< T, Tag > > Type;
+};
+
+template <typename T> struct KPagedPoolNativeSet
+{
+	typedef KNativeSet< T, KGuardedMutex, typename KPagedPoolAllocator< T >::Type > Type;
+};
+
+template <typename T> struct KNonPagedPoolNativeSet
+{
+	typedef KNativeSet< T, KSpinLock, typename KNonPagedPoolAllocator< T >::Type > Type;
+};
+
+template <typename T, ULONG Tag> struct KTaggedPagedPoolNativeSet
+{
+	typedef KNativeSet< T, KGuardedMutex, typename KTaggedPagedPoolAllocator< T, Tag >::Type > Type;
+};
+
+template <typename T, ULONG Tag> struct KTaggedNonPagedPoolNativeSet
+{
+	typedef KNativeSet< T, KSpinLock, typename KTaggedNonPagedPoolAllocator< T, Tag >::Type > Type;
+};
+
+template <typename T, ULONG Tag> struct KPagedLookasideNativeSet
+{
+	typedef KNativeSet< T, KGuardedMutex, KPagedLookasideAllocator< T, Tag > > Type;
+};
+
+template <typename T, ULONG Tag> struct KNonPagedLookasideNativeSet
+{
+	typedef KNativeSet< T, KSpinLock, KNonPagedLookasideAllocator< T, Tag > > Type;
 };
\ No newline at end of file
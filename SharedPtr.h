@@ -2,44 +2,109 @@
 
 #include "CommonDefinitions.h"
 #include "KernelNew.h"
+#include "Allocator.h"
 #include "Utility.h"
 
 static const ULONG sharedPtrCounterTag = 'CPhS';
 
-template
-<
-	typename Type,
-	POOL_TYPE Pool,
-	typename Deleter = KDefaultDelete<Type>,
-	typename Allocator = KDefaultNew<sharedPtrCounterTag, Pool, Type>
-> class KSharedPtr
+// Control block shared by every pointer to the object. Strong references keep the object alive, weak ones
+// keep only the control block. All strong references together hold a single weak one, so the block goes away
+// with the last reference of either kind. A counter allocated apart from the object has no routines, so the owner
+// deletes the object by its deleter and the counter by itself. A counter placed in one block with the object
+// by KAllocateShared() has routines destroying the object in place and freeing the whole block.
+class KSharedCounter
 {
-private:
-	class Counter_t
+public:
+	typedef void (*Release_t)(KSharedCounter* counter);
+
+	volatile LONG m_count;
+	volatile LONG m_weakCount;
+	Release_t m_destroy;
+	Release_t m_release;
+
+	KSharedCounter()
+		: m_count(1)
+		, m_weakCount(1)
+		, m_destroy(NULL)
+		, m_release(NULL)
 	{
-	public:
-		volatile LONG m_count;
+	}
 
-		Counter_t() : m_count(1)
-		{
-		}
+	KSharedCounter(const KSharedCounter&) {}
+	~KSharedCounter() {}
 
-		Counter_t(const Counter_t&) {}
-		~Counter_t() {}
+	KSharedCounter& operator = (const KSharedCounter&) { return *this; }
 
-		Counter_t& operator = (const Counter_t&) {};
+	void Reference() 
+	{
+		InterlockedIncrement(&m_count);
+	}
 
-		void Reference() 
-		{
-			InterlockedIncrement(&m_count);
-		}
+	// True means that owning object must be deleted.
+	bool Dereference()
+	{
+		return InterlockedDecrement(&m_count) == 0;
+	}
 
-		// True means that owning object must be deleted.
-		bool Dereference()
+	// Takes a strong reference unless the object has expired. The count never rises from zero, so it is only
+	// incremented by compare and swap. No lock is taken, thus promotion is allowed at DISPATCH_LEVEL.
+	bool TryReference()
+	{
+		LONG count = m_count;
+		while (count)
 		{
-			return InterlockedDecrement(&m_count) == 0;
+			LONG prev = InterlockedCompareExchange(&m_count, count + 1, count);
+			if (prev == count)
+				return true;
+
+			count = prev;
 		}
-	};
+
+		return false;
+	}
+
+	void WeakReference()
+	{
+		InterlockedIncrement(&m_weakCount);
+	}
+
+	// Frees the control block once the last weak reference, including the one held by strong ones, is gone.
+	void WeakDereference()
+	{
+		if (InterlockedDecrement(&m_weakCount))
+			return;
+
+		if (m_release)
+			m_release(this);
+		else
+			delete this;
+	}
+
+	bool IsExpired() const
+	{
+		return m_count == 0;
+	}
+};
+
+// Opens construction of a pointer from a counter and an object to KAllocateShared().
+struct KSharedPtrAccess
+{
+	template <typename Ptr, typename Type> static Ptr Attach(__in_opt KSharedCounter* counter, __in_opt Type* obj)
+	{
+		return Ptr(counter, obj);
+	}
+};
+
+template
+<
+	typename Type,
+	POOL_TYPE Pool,
+	typename Deleter = KDefaultDelete<Type>,
+	typename Allocator = KDefaultNew<sharedPtrCounterTag, Pool, Type>
+> class KSharedPtr
+{
+private:
+	typedef KSharedCounter Counter_t;
 
 private:
 	bool m_valid;
@@ -50,6 +115,9 @@ private:
 
 private:
 	template<typename OtherType, POOL_TYPE Pool, typename Deleter, typename Allocator> friend class KSharedPtr;
+	template<typename OtherType, POOL_TYPE Pool, typename Deleter, typename Allocator> friend class KWeakPtr;
+	template<typename OtherType, POOL_TYPE Pool, typename Deleter, typename Allocator> friend class KAtomicSharedPtr;
+	friend struct KSharedPtrAccess;
 
 private:
 	// True means the owning object has been deleted.
@@ -60,8 +128,12 @@ private:
 
 		if (m_counter && m_counter->Dereference())
 		{
-			m_deleter(m_obj);
-			delete m_counter;
+			if (m_counter->m_destroy)
+				m_counter->m_destroy(m_counter);
+			else
+				m_deleter(m_obj);
+
+			m_counter->WeakDereference();
 			deleted = true;
 		}
 
@@ -102,23 +174,15 @@ private:
 	template<typename OtherType, POOL_TYPE Pool, typename Deleter, typename Allocator>
 	void Init(__in const KSharedPtr<OtherType, Pool, Deleter, Allocator>& other)
 	{
-		if (other.m_counter)
+		// Pointer without a counter, e.g. a failed promotion or allocation, copies as an invalid one.
+		// Nothing is allocated then, so copies are made at any IRQL the source was obtained at.
+		if (!other.m_counter)
 		{
-			InterlockedExchangePointer(reinterpret_cast<volatile PVOID*>(&m_counter), other.m_counter);
-		}
-		else
-		{
-			m_counter = new (sharedPtrCounterTag, Pool) Counter_t;
-			ASSERT(m_counter);
-
-			// Additional verification, for more details see comment to function overload above.
-			if (!m_counter)
-			{
-				ZeroOut();
-				return;
-			}
+			ZeroOut();
+			return;
 		}
 
+		InterlockedExchangePointer(reinterpret_cast<volatile PVOID*>(&m_counter), other.m_counter);
 		InterlockedExchangePointer(reinterpret_cast<volatile PVOID*>(&m_obj), other.m_obj);
 		m_counter->Reference();
 		m_valid = true;
@@ -142,6 +206,15 @@ private:
 		Init<Type, Pool, Deleter, Allocator>(other);
 	}
 
+	// Takes over the counter already referenced on behalf of the pointer. Both are NULL if the block
+	// could not be allocated, the pointer is invalid then.
+	KSharedPtr(__in_opt Counter_t* counter, __in_opt Type* obj)
+		: m_valid(counter != NULL)
+		, m_counter(counter)
+		, m_obj(obj)
+	{
+	}
+
 public:
 	explicit KSharedPtr(Type* obj = NULL)
 		: m_valid(true)
@@ -164,6 +237,38 @@ public:
 		return *this;
 	}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	// Takes over the reference of the other pointer, so the count is not touched. The other pointer
+	// is left without an object.
+	KSharedPtr(KSharedPtr&& other)
+		: m_valid(other.m_valid)
+		, m_counter(other.m_counter)
+		, m_obj(other.m_obj)
+		, m_deleter(other.m_deleter)
+		, m_allocator(other.m_allocator)
+	{
+		other.ZeroOut();
+	}
+
+	KSharedPtr& operator = (KSharedPtr&& other)
+	{
+		if (this != &other)
+		{
+			Cleanup();
+
+			m_valid = other.m_valid;
+			m_counter = other.m_counter;
+			m_obj = other.m_obj;
+			m_deleter = other.m_deleter;
+			m_allocator = other.m_allocator;
+
+			other.ZeroOut();
+		}
+
+		return *this;
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
 	explicit KSharedPtr(const Deleter& del, Type* obj = NULL)
 		: m_valid(true)
 		, m_counter(NULL)
@@ -237,8 +342,271 @@ public:
 	}
 };
 
+// Reference to an object owned by shared pointers which does not keep the object alive. Caches hold
+// objects by weak pointers and promote them by Lock() on access, which fails once the object has expired.
+template
+<
+	typename Type,
+	POOL_TYPE Pool,
+	typename Deleter = KDefaultDelete<Type>,
+	typename Allocator = KDefaultNew<sharedPtrCounterTag, Pool, Type>
+> class KWeakPtr
+{
+	typedef KSharedPtr<Type, Pool, Deleter, Allocator> Shared_t;
+	typedef KSharedCounter Counter_t;
+
+	Counter_t* m_counter;
+	Type* m_obj;
+
+public:
+	KWeakPtr()
+		: m_counter(NULL)
+		, m_obj(NULL)
+	{
+	}
+
+	KWeakPtr(const Shared_t& other)
+		: m_counter(other.m_counter)
+		, m_obj(other.m_obj)
+	{
+		if (m_counter)
+			m_counter->WeakReference();
+	}
+
+	KWeakPtr(const KWeakPtr& other)
+		: m_counter(other.m_counter)
+		, m_obj(other.m_obj)
+	{
+		if (m_counter)
+			m_counter->WeakReference();
+	}
+
+	~KWeakPtr()
+	{
+		Reset();
+	}
+
+	KWeakPtr& operator = (const KWeakPtr& other)
+	{
+		Assign(other.m_counter, other.m_obj);
+		return *this;
+	}
+
+	KWeakPtr& operator = (const Shared_t& other)
+	{
+		Assign(other.m_counter, other.m_obj);
+		return *this;
+	}
+
+	// Returns a shared pointer owning the object or an invalid one if the object has expired.
+	// Promotion neither allocates nor waits, so it is allowed at DISPATCH_LEVEL. Yet if the pointer returned
+	// turns out to be the last one, the object is deleted at the IRQL the pointer goes away at.
+	__drv_maxIRQL(DISPATCH_LEVEL)
+	Shared_t Lock() const
+	{
+		if (m_counter && m_counter->TryReference())
+			return Shared_t(m_counter, m_obj);
+
+		return Shared_t(static_cast<Counter_t*>(NULL), static_cast<Type*>(NULL));
+	}
+
+	// Snapshot only, the object may expire as soon as the call returns. Use Lock() to access the object.
+	bool IsExpired() const
+	{
+		return !m_counter || m_counter->IsExpired();
+	}
+
+	void Reset()
+	{
+		Counter_t* counter = m_counter;
+		m_counter = NULL;
+		m_obj = NULL;
+
+		if (counter)
+			counter->WeakDereference();
+	}
+
+private:
+	// Reference of the source is taken before the own one is dropped, so self-assignment is harmless.
+	void Assign(__in_opt Counter_t* counter, __in_opt Type* obj)
+	{
+		if (counter)
+			counter->WeakReference();
+
+		Reset();
+		m_counter = counter;
+		m_obj = obj;
+	}
+};
+
 template <typename T, typename U, POOL_TYPE Pool, typename Deleter, typename Allocator>
 KSharedPtr<T, Pool> StaticPointerCast(__in const KSharedPtr<U, Pool, Deleter, Allocator>& sp)
 {
 	return static_cast<T*>(sp.Get());
+}
+
+// Block holding the counter followed by the object, so that a shared object costs a single allocation
+// and its counter shares the cache line with the head of the object. The object is destroyed with the last
+// strong reference, while the block stays until weak references are gone as well. The block keeps a copy
+// of the allocator to free itself by, thus the allocator must be copyable from its rebound flavour as pool allocators are.
+// Lookaside allocators keep a list per instance and serve a single size, so they cannot be used.
+template <typename Type, typename Alloc> struct KSharedBlock
+{
+	typedef typename Alloc::template Rebind_t<KSharedBlock>::Other_t BlockAlloc_t;
+
+	KSharedCounter counter;
+	Type obj;
+	BlockAlloc_t allocator;
+
+	explicit KSharedBlock(const BlockAlloc_t& alloc)
+		: counter()
+		, obj()
+		, allocator(alloc)
+	{
+		counter.m_destroy = &KSharedBlock::Destroy;
+		counter.m_release = &KSharedBlock::Release;
+	}
+
+	template <typename A1> KSharedBlock(const BlockAlloc_t& alloc, const A1& a1)
+		: counter()
+		, obj(a1)
+		, allocator(alloc)
+	{
+		counter.m_destroy = &KSharedBlock::Destroy;
+		counter.m_release = &KSharedBlock::Release;
+	}
+
+	template <typename A1, typename A2> KSharedBlock(const BlockAlloc_t& alloc, const A1& a1, const A2& a2)
+		: counter()
+		, obj(a1, a2)
+		, allocator(alloc)
+	{
+		counter.m_destroy = &KSharedBlock::Destroy;
+		counter.m_release = &KSharedBlock::Release;
+	}
+
+	template <typename A1, typename A2, typename A3> KSharedBlock(const BlockAlloc_t& alloc, const A1& a1, const A2& a2, const A3& a3)
+		: counter()
+		, obj(a1, a2, a3)
+		, allocator(alloc)
+	{
+		counter.m_destroy = &KSharedBlock::Destroy;
+		counter.m_release = &KSharedBlock::Release;
+	}
+
+	~KSharedBlock() {}
+
+	// Counter is the first member, so the block starts where the counter does.
+	static void Destroy(__in KSharedCounter* counter)
+	{
+		reinterpret_cast<KSharedBlock*>(counter)->obj.~Type();
+	}
+
+	// The object has been destroyed already, so the members left are torn down one by one.
+	static void Release(__in KSharedCounter* counter)
+	{
+		KSharedBlock* block = reinterpret_cast<KSharedBlock*>(counter);
+		BlockAlloc_t alloc(block->allocator);
+
+		block->allocator.~BlockAlloc_t();
+		block->counter.~KSharedCounter();
+		alloc.Deallocate(block);
+	}
+
+	template <POOL_TYPE Pool> static KSharedPtr<Type, Pool> GetPointer(__in_opt KSharedBlock* block)
+	{
+		if (!block)
+			return KSharedPtrAccess::Attach< KSharedPtr<Type, Pool>, Type >(NULL, NULL);
+
+		return KSharedPtrAccess::Attach< KSharedPtr<Type, Pool>, Type >(&block->counter, &block->obj);
+	}
+
+	__checkReturn
+	static KSharedBlock* Allocate(__in BlockAlloc_t& alloc)
+	{
+		KSharedBlock* block = alloc.Allocate(sizeof(KSharedBlock));
+		ASSERT(block);
+
+		return block;
+	}
+};
+
+// Creates the object and its counter in a single allocation made by given allocator. Arguments, up to three,
+// are passed to the constructor of the object. On allocation failure the pointer returned is invalid and NULL.
+// Copying and resetting the pointer behave the same as for pointers owning separately allocated objects.
+template <typename Type, POOL_TYPE Pool, typename Alloc>
+KSharedPtr<Type, Pool> KAllocateShared(__in const Alloc& alloc)
+{
+	typedef KSharedBlock<Type, Alloc> Block_t;
+	typename Block_t::BlockAlloc_t blockAlloc(alloc);
+
+	Block_t* block = Block_t::Allocate(blockAlloc);
+	if (block)
+		new (block) Block_t(blockAlloc);
+
+	return Block_t::template GetPointer<Pool>(block);
+}
+
+template <typename Type, POOL_TYPE Pool, typename Alloc, typename A1>
+KSharedPtr<Type, Pool> KAllocateShared(__in const Alloc& alloc, __in const A1& a1)
+{
+	typedef KSharedBlock<Type, Alloc> Block_t;
+	typename Block_t::BlockAlloc_t blockAlloc(alloc);
+
+	Block_t* block = Block_t::Allocate(blockAlloc);
+	if (block)
+		new (block) Block_t(blockAlloc, a1);
+
+	return Block_t::template GetPointer<Pool>(block);
+}
+
+template <typename Type, POOL_TYPE Pool, typename Alloc, typename A1, typename A2>
+KSharedPtr<Type, Pool> KAllocateShared(__in const Alloc& alloc, __in const A1& a1, __in const A2& a2)
+{
+	typedef KSharedBlock<Type, Alloc> Block_t;
+	typename Block_t::BlockAlloc_t blockAlloc(alloc);
+
+	Block_t* block = Block_t::Allocate(blockAlloc);
+	if (block)
+		new (block) Block_t(blockAlloc, a1, a2);
+
+	return Block_t::template GetPointer<Pool>(block);
+}
+
+template <typename Type, POOL_TYPE Pool, typename Alloc, typename A1, typename A2, typename A3>
+KSharedPtr<Type, Pool> KAllocateShared(__in const Alloc& alloc, __in const A1& a1, __in const A2& a2, __in const A3& a3)
+{
+	typedef KSharedBlock<Type, Alloc> Block_t;
+	typename Block_t::BlockAlloc_t blockAlloc(alloc);
+
+	Block_t* block = Block_t::Allocate(blockAlloc);
+	if (block)
+		new (block) Block_t(blockAlloc, a1, a2, a3);
+
+	return Block_t::template GetPointer<Pool>(block);
+}
+
+// Same as KAllocateShared() with the pool of the pointer tagged as separately allocated counters are.
+template <typename Type, POOL_TYPE Pool>
+KSharedPtr<Type, Pool> KMakeShared()
+{
+	return KAllocateShared<Type, Pool>(KTaggedPoolAllocator<Type, sharedPtrCounterTag, Pool>());
+}
+
+template <typename Type, POOL_TYPE Pool, typename A1>
+KSharedPtr<Type, Pool> KMakeShared(__in const A1& a1)
+{
+	return KAllocateShared<Type, Pool>(KTaggedPoolAllocator<Type, sharedPtrCounterTag, Pool>(), a1);
+}
+
+template <typename Type, POOL_TYPE Pool, typename A1, typename A2>
+KSharedPtr<Type, Pool> KMakeShared(__in const A1& a1, __in const A2& a2)
+{
+	return KAllocateShared<Type, Pool>(KTaggedPoolAllocator<Type, sharedPtrCounterTag, Pool>(), a1, a2);
+}
+
+template <typename Type, POOL_TYPE Pool, typename A1, typename A2, typename A3>
+KSharedPtr<Type, Pool> KMakeShared(__in const A1& a1, __in const A2& a2, __in const A3& a3)
+{
+	return KAllocateShared<Type, Pool>(KTaggedPoolAllocator<Type, sharedPtrCounterTag, Pool>(), a1, a2, a3);
 }
\ No newline at end of file
@@ -81,7 +81,7 @@ public:
 		static_cast<ConcreteRWLock*>(this)->LockExclusive();
 	}
 
-	void Unock()
+	void Unlock()
 	{
 		static_cast<ConcreteRWLock*>(this)->Unlock();
 	}
@@ -108,6 +108,67 @@ private:
 	T& m_lock;
 };
 
+// Guards requesting shared or exclusive access from any lock of this file. Exclusive locks have
+// no shared mode, thus they are acquired exclusively on either request. This lets containers
+// accept both kinds of locks through the same template parameter.
+template <typename T> class KSharedLocker
+{
+	CLASS_NO_COPY(KSharedLocker)
+public:
+	KSharedLocker(T& lock) : m_lock(lock)
+	{
+		Acquire(m_lock);
+	}
+
+	~KSharedLocker()
+	{
+		m_lock.Unlock();
+	}
+
+private:
+	template <typename U> static void Acquire(KLock<U>& lock)
+	{
+		static_cast<U&>(lock).Lock();
+	}
+
+	template <typename U> static void Acquire(KRWLock<U>& lock)
+	{
+		static_cast<U&>(lock).LockShared();
+	}
+
+private:
+	T& m_lock;
+};
+
+template <typename T> class KExclusiveLocker
+{
+	CLASS_NO_COPY(KExclusiveLocker)
+public:
+	KExclusiveLocker(T& lock) : m_lock(lock)
+	{
+		Acquire(m_lock);
+	}
+
+	~KExclusiveLocker()
+	{
+		m_lock.Unlock();
+	}
+
+private:
+	template <typename U> static void Acquire(KLock<U>& lock)
+	{
+		static_cast<U&>(lock).Lock();
+	}
+
+	template <typename U> static void Acquire(KRWLock<U>& lock)
+	{
+		static_cast<U&>(lock).LockExclusive();
+	}
+
+private:
+	T& m_lock;
+};
+
 class KSpinLock : public KLock<KSpinLock>
 {
 	CLASS_NO_COPY(KSpinLock)
@@ -129,6 +190,21 @@ public:
 		KeReleaseSpinLock(&m_lock, m_irql);
 	}
 
+	// IRQL is restored when the lock turns out to be busy.
+	bool TryLock()
+	{
+		KIRQL irql;
+		KeRaiseIrql(DISPATCH_LEVEL, &irql);
+		if (!KeTryToAcquireSpinLockAtDpcLevel(&m_lock))
+		{
+			KeLowerIrql(irql);
+			return false;
+		}
+
+		m_irql = irql;
+		return true;
+	}
+
 	PKSPIN_LOCK Get()
 	{
 		return &m_lock;
@@ -139,33 +215,115 @@ private:
 	KIRQL m_irql;
 };
 
-class KQueuedLock : public KLock<KQueuedLock>
+// Queued spin lock granting the lock to waiters in FIFO order, each of them spinning on its own queue entry
+// rather than on the lock. Every acquisition needs a queue handle of its own, which must stay in place until
+// the release, so the lock has no Lock()/Unlock() of its own and is acquired through KQueuedLocker,
+// which keeps the handle on the caller's stack. KLocker, KSharedLocker and KExclusiveLocker do the same for it,
+// so containers accept it as any other lock. The lock must live in nonpaged memory.
+class KQueuedLock
 {
 	CLASS_NO_COPY(KQueuedLock)
 public:
 	KQueuedLock()
 	{
-		RtlZeroMemory(&m_handle, sizeof(KLOCK_QUEUE_HANDLE));
 		KeInitializeSpinLock(&m_lock);
 	}
 
 	~KQueuedLock() {}
 
-	void Lock()
+	__drv_maxIRQL(DISPATCH_LEVEL)
+	__drv_raisesIRQL(DISPATCH_LEVEL)
+	void Lock(__out PKLOCK_QUEUE_HANDLE handle)
 	{
-		KeAcquireInStackQueuedSpinLock(&m_lock, &m_handle);
+		KeAcquireInStackQueuedSpinLock(&m_lock, handle);
 	}
 
-	void Unlock()
+	__drv_requiresIRQL(DISPATCH_LEVEL)
+	void Unlock(__in PKLOCK_QUEUE_HANDLE handle)
+	{
+		KeReleaseInStackQueuedSpinLock(handle);
+	}
+
+	// Variants for callers at DISPATCH_LEVEL already, which spare raising and restoring IRQL.
+	__drv_requiresIRQL(DISPATCH_LEVEL)
+	void LockAtDpcLevel(__out PKLOCK_QUEUE_HANDLE handle)
 	{
-		KeReleaseInStackQueuedSpinLock(&m_handle);
+		KeAcquireInStackQueuedSpinLockAtDpcLevel(&m_lock, handle);
+	}
+
+	__drv_requiresIRQL(DISPATCH_LEVEL)
+	void UnlockFromDpcLevel(__in PKLOCK_QUEUE_HANDLE handle)
+	{
+		KeReleaseInStackQueuedSpinLockFromDpcLevel(handle);
+	}
+
+	PKSPIN_LOCK Get()
+	{
+		return &m_lock;
 	}
 
 private:
 	KSPIN_LOCK m_lock;
+};
+
+class KQueuedLocker
+{
+	CLASS_NO_COPY(KQueuedLocker)
+public:
+	__drv_maxIRQL(DISPATCH_LEVEL)
+	KQueuedLocker(KQueuedLock& lock) : m_lock(&lock)
+	{
+		m_lock->Lock(&m_handle);
+	}
+
+	~KQueuedLocker()
+	{
+		m_lock->Unlock(&m_handle);
+	}
+
+private:
+	KQueuedLock* m_lock;
 	KLOCK_QUEUE_HANDLE m_handle;
 };
 
+class KQueuedLockerAtDpcLevel
+{
+	CLASS_NO_COPY(KQueuedLockerAtDpcLevel)
+public:
+	__drv_requiresIRQL(DISPATCH_LEVEL)
+	KQueuedLockerAtDpcLevel(KQueuedLock& lock) : m_lock(&lock)
+	{
+		m_lock->LockAtDpcLevel(&m_handle);
+	}
+
+	~KQueuedLockerAtDpcLevel()
+	{
+		m_lock->UnlockFromDpcLevel(&m_handle);
+	}
+
+private:
+	KQueuedLock* m_lock;
+	KLOCK_QUEUE_HANDLE m_handle;
+};
+
+template <> class KLocker<KQueuedLock> : public KQueuedLocker
+{
+public:
+	KLocker(KQueuedLock& lock) : KQueuedLocker(lock) {}
+};
+
+template <> class KSharedLocker<KQueuedLock> : public KQueuedLocker
+{
+public:
+	KSharedLocker(KQueuedLock& lock) : KQueuedLocker(lock) {}
+};
+
+template <> class KExclusiveLocker<KQueuedLock> : public KQueuedLocker
+{
+public:
+	KExclusiveLocker(KQueuedLock& lock) : KQueuedLocker(lock) {}
+};
+
 class KMutex : public KLock<KMutex>
 {
 	CLASS_NO_COPY(KMutex)
@@ -212,6 +370,11 @@ public:
 		ExReleaseFastMutex(&m_mutex);
 	}
 
+	bool TryLock()
+	{
+		return !!ExTryToAcquireFastMutex(&m_mutex);
+	}
+
 private:
 	FAST_MUTEX m_mutex;
 };
@@ -237,10 +400,28 @@ public:
 		KeReleaseGuardedMutex(&m_mutex);
 	}
 
+	bool TryLock()
+	{
+		return !!KeTryToAcquireGuardedMutex(&m_mutex);
+	}
+
 private:
 	KGUARDED_MUTEX m_mutex;
 };
 
+// Lock which does nothing. Suits containers which are accessed by a single thread or never modified
+// after publication, and containers guarded by a lock of the owner.
+class KNullLock : public KLock<KNullLock>
+{
+	CLASS_NO_COPY(KNullLock)
+public:
+	KNullLock() {}
+	~KNullLock() {}
+
+	void Lock() {}
+	void Unlock() {}
+};
+
 class KResource : public KRWLock<KResource>
 {
 	CLASS_NO_COPY(KResource)
@@ -278,6 +459,27 @@ public:
 		KeLeaveCriticalRegion();
 	}
 
+	// The critical region is left again when the resource turns out to be busy.
+	bool TryLockExclusive()
+	{
+		KeEnterCriticalRegion();
+		if (ExAcquireResourceExclusiveLite(&m_res, false))
+			return true;
+
+		KeLeaveCriticalRegion();
+		return false;
+	}
+
+	bool TryLockShared()
+	{
+		KeEnterCriticalRegion();
+		if (ExAcquireResourceSharedLite(&m_res, false))
+			return true;
+
+		KeLeaveCriticalRegion();
+		return false;
+	}
+
 	void Reset()
 	{
 		ExReinitializeResourceLite(&m_res);
@@ -320,6 +522,214 @@ private:
 	EX_PUSH_LOCK m_pushLock;
 };
 
+// Reader-writer spin lock usable at IRQL <= DISPATCH_LEVEL, e.g. for read-mostly structures looked up from DPCs.
+// Readers hold the lock concurrently and a waiting writer keeps new readers out, so writers are not starved.
+// Executive spin locks are used where available, otherwise a portable interlocked state word.
+//
+// The exclusive owner keeps the IRQL it came from in the lock, yet readers cannot, since they hold it
+// in parallel. A shared acquisition thus hands its IRQL to the caller, and KSharedLocker and KRWLocker
+// are specialized to keep it on the caller's stack. Shared acquisitions must not nest, since a writer
+// waiting meanwhile would keep the nested one out for good. The lock must live in nonpaged memory.
+class KRWSpinLock : public KRWLock<KRWSpinLock>
+{
+	CLASS_NO_COPY(KRWSpinLock)
+public:
+	KRWSpinLock()
+		: m_lock(0)
+		, m_irql(PASSIVE_LEVEL)
+	{
+	}
+
+	~KRWSpinLock() {}
+
+	__drv_maxIRQL(DISPATCH_LEVEL)
+	__drv_raisesIRQL(DISPATCH_LEVEL)
+	void LockShared(__out PKIRQL irql)
+	{
+#if (NTDDI_VERSION >= NTDDI_VISTASP1)
+		*irql = ExAcquireSpinLockShared(&m_lock);
+#else
+		KeRaiseIrql(DISPATCH_LEVEL, irql);
+		LockSharedAtDpcLevel();
+#endif
+	}
+
+	__drv_requiresIRQL(DISPATCH_LEVEL)
+	void UnlockShared(__in KIRQL irql)
+	{
+#if (NTDDI_VERSION >= NTDDI_VISTASP1)
+		ExReleaseSpinLockShared(&m_lock, irql);
+#else
+		UnlockSharedFromDpcLevel();
+		KeLowerIrql(irql);
+#endif
+	}
+
+	__drv_maxIRQL(DISPATCH_LEVEL)
+	__drv_raisesIRQL(DISPATCH_LEVEL)
+	void LockExclusive()
+	{
+		KIRQL irql;
+#if (NTDDI_VERSION >= NTDDI_VISTASP1)
+		irql = ExAcquireSpinLockExclusive(&m_lock);
+#else
+		KeRaiseIrql(DISPATCH_LEVEL, &irql);
+		LockExclusiveAtDpcLevel();
+#endif
+		m_irql = irql;
+	}
+
+	// Releases the exclusive acquisition only, shared ones are released by UnlockShared().
+	__drv_requiresIRQL(DISPATCH_LEVEL)
+	void Unlock()
+	{
+		KIRQL irql = m_irql;
+#if (NTDDI_VERSION >= NTDDI_VISTASP1)
+		ExReleaseSpinLockExclusive(&m_lock, irql);
+#else
+		UnlockExclusiveFromDpcLevel();
+		KeLowerIrql(irql);
+#endif
+	}
+
+	// Shared acquisition for callers at DISPATCH_LEVEL already, such as DPC routines. IRQL is neither raised
+	// nor restored, so the lock must be released by UnlockSharedFromDpcLevel().
+	__drv_requiresIRQL(DISPATCH_LEVEL)
+	void LockSharedAtDpcLevel()
+	{
+#if (NTDDI_VERSION >= NTDDI_VISTASP1)
+		ExAcquireSpinLockSharedAtDpcLevel(&m_lock);
+#else
+		for (;;)
+		{
+			LONG state = m_lock;
+			if (!(state & s_writer) && (InterlockedCompareExchange(&m_lock, state + 1, state) == state))
+				return;
+
+			YieldProcessor();
+		}
+#endif
+	}
+
+	__drv_requiresIRQL(DISPATCH_LEVEL)
+	void UnlockSharedFromDpcLevel()
+	{
+#if (NTDDI_VERSION >= NTDDI_VISTASP1)
+		ExReleaseSpinLockSharedFromDpcLevel(&m_lock);
+#else
+		InterlockedDecrement(&m_lock);
+#endif
+	}
+
+private:
+	// Writer flag of the portable lock, the rest of the state word counts readers.
+	static const LONG s_writer = 0x40000000;
+
+private:
+	// Portable writer raises its flag first, so that new readers keep out while the ones inside drain.
+	void LockExclusiveAtDpcLevel()
+	{
+#if (NTDDI_VERSION >= NTDDI_VISTASP1)
+		ExAcquireSpinLockExclusiveAtDpcLevel(&m_lock);
+#else
+		for (;;)
+		{
+			LONG state = m_lock;
+			if (!(state & s_writer) && (InterlockedCompareExchange(&m_lock, state | s_writer, state) == state))
+				break;
+
+			YieldProcessor();
+		}
+
+		while (m_lock != s_writer)
+			YieldProcessor();
+#endif
+	}
+
+	void UnlockExclusiveFromDpcLevel()
+	{
+#if (NTDDI_VERSION >= NTDDI_VISTASP1)
+		ExReleaseSpinLockExclusiveFromDpcLevel(&m_lock);
+#else
+		InterlockedExchange(&m_lock, 0);
+#endif
+	}
+
+private:
+	volatile LONG m_lock;
+	KIRQL m_irql;
+};
+
+template <> class KSharedLocker<KRWSpinLock>
+{
+	CLASS_NO_COPY(KSharedLocker)
+public:
+	__drv_maxIRQL(DISPATCH_LEVEL)
+	KSharedLocker(KRWSpinLock& lock) : m_lock(&lock)
+	{
+		m_lock->LockShared(&m_irql);
+	}
+
+	~KSharedLocker()
+	{
+		m_lock->UnlockShared(m_irql);
+	}
+
+private:
+	KRWSpinLock* m_lock;
+	KIRQL m_irql;
+};
+
+template <> class KRWLocker<KRWSpinLock>
+{
+	CLASS_NO_COPY(KRWLocker)
+public:
+	__drv_maxIRQL(DISPATCH_LEVEL)
+	KRWLocker(KRWSpinLock& lock, bool exclusive)
+		: m_lock(&lock)
+		, m_exclusive(exclusive)
+		, m_irql(PASSIVE_LEVEL)
+	{
+		if (m_exclusive)
+			m_lock->LockExclusive();
+		else
+			m_lock->LockShared(&m_irql);
+	}
+
+	~KRWLocker()
+	{
+		if (m_exclusive)
+			m_lock->Unlock();
+		else
+			m_lock->UnlockShared(m_irql);
+	}
+
+private:
+	KRWSpinLock* m_lock;
+	bool m_exclusive;
+	KIRQL m_irql;
+};
+
+// Shared guard for code running at DISPATCH_LEVEL already, which spares raising and restoring IRQL.
+template <typename T = KRWSpinLock> class KSharedLockerAtDpcLevel
+{
+	CLASS_NO_COPY(KSharedLockerAtDpcLevel)
+public:
+	__drv_requiresIRQL(DISPATCH_LEVEL)
+	KSharedLockerAtDpcLevel(T& lock) : m_lock(lock)
+	{
+		m_lock.LockSharedAtDpcLevel();
+	}
+
+	~KSharedLockerAtDpcLevel()
+	{
+		m_lock.UnlockSharedFromDpcLevel();
+	}
+
+private:
+	T& m_lock;
+};
+
 class KSemaphore
 {
 	CLASS_NO_COPY(KSemaphore)
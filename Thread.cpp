@@ -3,26 +3,26 @@
 KThread::KThread(PKSTART_ROUTINE threadFun, PVOID ctx)
 : KThreadingBase(threadFun, ctx)
 {
-	CreateThread(m_object);
+	PETHREAD threadObject = NULL;
+	if (CreateThread(threadObject))
+		m_object.Attach(threadObject);
 }
 
 KThread::~KThread()
 {
-	if (m_object)
-		ObDereferenceObject(m_object);
 }
 
 bool KThread::IsValid()
 {
-	return m_object != NULL;
+	return m_object;
 }
 
 PETHREAD KThread::Get() const
 {
-	return m_object;
+	return m_object.Get();
 }
 
 void KThread::Wait(__in const KTimeout& timeout)
 {
-	KeWaitForSingleObject(m_object, Executive, KernelMode, FALSE, timeout.Get());
+	KeWaitForSingleObject(m_object.Get(), Executive, KernelMode, FALSE, timeout.Get());
 }
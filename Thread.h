@@ -2,6 +2,7 @@
 
 #include "CommonDefinitions.h"
 #include "Threading.h"
+#include "RefPtr.h"
 
 class KThread : public KThreadingBase<KThread>
 {
@@ -16,5 +17,5 @@ public:
 	void Wait(__in const KTimeout& timeout);
 
 private:
-	PETHREAD m_object;
+	KThreadRefPtr m_object;
 };
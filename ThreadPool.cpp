@@ -11,18 +11,15 @@ KThreadPool::KThreadPool(ULONG num, PKSTART_ROUTINE threadFun, PVOID ctx)
 		if (!CreateThread(threadObject))
 			continue;
 
-		m_threads.InsertLast(threadObject);
+		KThreadRefPtr thread;
+		thread.Attach(threadObject);
+		m_threads.InsertLast(thread);
 	}
 }
 
+// Thread objects are dereferenced by the list dropping its items.
 KThreadPool::~KThreadPool()
 {
-	for (ThreadList_t::RevIter_t it = m_threads.RBegin(); it != m_threads.REnd(); --it)
-	{
-		PVOID obj = *it;
-		if (obj)
-			ObDereferenceObject(obj);
-	}
 }
 
 bool KThreadPool::IsValid()
@@ -52,7 +49,7 @@ void KThreadPool::Wait(__in const KTimeout& timeout)
 
 	ThreadList_t::Iter_t it = m_threads.Begin();
 	for (ULONG i = 0; it != m_threads.End(); ++it, ++i)
-		pObjects[i] = *it;
+		pObjects[i] = (*it).Get();
 
 	NTSTATUS status = KeWaitForMultipleObjects(num, pObjects, WaitAll, 
 		Executive, KernelMode, FALSE, timeout.Get(), pWaitBlock);
@@ -3,6 +3,7 @@
 #include "CommonDefinitions.h"
 #include "Threading.h"
 #include "List.h"
+#include "RefPtr.h"
 
 class KThreadPool  : public KThreadingBase<KThreadPool>
 {
@@ -20,7 +21,7 @@ public:
 	ULONG GetThreadCount() const;
 
 private:
-	typedef KTaggedNonPagedPoolList<PETHREAD, s_tag>::Type ThreadList_t;
+	typedef KTaggedNonPagedPoolList<KThreadRefPtr, s_tag>::Type ThreadList_t;
 
 private:
 	mutable ThreadList_t m_threads;
@@ -63,6 +63,40 @@ template <typename Tp> struct RemoveCV
 	typedef typename RemoveConst<typename RemoveVolatile<Tp>::type>::type type;
 };
 
+/// pointer modifications [4.7.4].
+template <typename Tp> struct RemovePointer
+{
+	typedef Tp type;
+};
+
+template <typename Tp> struct RemovePointer<Tp*>
+{
+	typedef Tp type;
+};
+
+template <typename Tp> struct RemovePointer<Tp* const>
+{
+	typedef Tp type;
+};
+
+/// reference modifications [4.7.2].
+template <typename Tp> struct RemoveReference
+{
+	typedef Tp type;
+};
+
+template <typename Tp> struct RemoveReference<Tp&>
+{
+	typedef Tp type;
+};
+
+#if defined(CXX11_MOVE_SEMANTICS)
+template <typename Tp> struct RemoveReference<Tp&&>
+{
+	typedef Tp type;
+};
+#endif // CXX11_MOVE_SEMANTICS
+
 template <bool Cond, typename T = void> struct EnableIf
 {};
 
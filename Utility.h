@@ -1,5 +1,21 @@
 #pragma once
 
+#include "TypeTraits.h"
+
+#if defined(CXX11_MOVE_SEMANTICS)
+// Casts the value to an rvalue, so that it is moved from rather than copied.
+template <typename T> typename RemoveReference<T>::type&& Move(T&& val)
+{
+	return static_cast<typename RemoveReference<T>::type&&>(val);
+}
+#else
+// Legacy build has no rvalues, so moving falls back to copying.
+template <typename T> T& Move(T& val)
+{
+	return val;
+}
+#endif // CXX11_MOVE_SEMANTICS
+
 template <typename T1, typename T2> struct KPair
 {
 	typedef T1 First_t;
@@ -29,6 +45,31 @@ template <typename T1, typename T2> struct KPair
 	{
 	}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	KPair(KPair&& other)
+		: first(::Move(other.first))
+		, second(::Move(other.second))
+	{
+	}
+
+	KPair(First_t&& a, Second_t&& b)
+		: first(::Move(a))
+		, second(::Move(b))
+	{
+	}
+
+	KPair& operator = (KPair&& other)
+	{
+		if (this != &other)
+		{
+			first = ::Move(other.first);
+			second = ::Move(other.second);
+		}
+
+		return *this;
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
 	template<typename U, typename V> KPair(const KPair<U, V>& other)
 		: first(other.first)
 		, second(other.second)
@@ -93,11 +134,33 @@ template <typename T1, typename T2> KPair<T1, T2> MakePair(T1 x, T2 y)
 	return (KPair<T1, T2>(x, y));
 }
 
+// Key extraction policies of ordered containers. They let lookups deal with a key only
+// rather than building a whole item around it.
+template <typename T> struct KIdentityKey
+{
+	typedef T Key_t;
+
+	static const Key_t& Get(const T& val)
+	{
+		return val;
+	}
+};
+
+template <typename Pair> struct KSelectFirstKey
+{
+	typedef typename Pair::First_t Key_t;
+
+	static const Key_t& Get(const Pair& val)
+	{
+		return val.first;
+	}
+};
+
 template <typename T> void Swap(T& source, T& dest)
 {
-	T temp(source);
-	source = dest;
-	dest = temp;
+	T temp(::Move(source));
+	source = ::Move(dest);
+	dest = ::Move(temp);
 }
 
 template <ULONG Tag, POOL_TYPE Pool, typename Type> struct KDefaultNew
@@ -115,3 +178,37 @@ template <typename Type> struct KDefaultDelete
 		delete obj;
 	}
 };
+
+// Finalization step of MurmurHash3. Spreads entropy of every input bit over the whole result
+// so that hash tables may take bucket indexes from either low or high bits.
+inline ULONG HashMix(ULONG h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+inline ULONG HashMix(ULONGLONG h)
+{
+	return HashMix(static_cast<ULONG>(h) ^ static_cast<ULONG>(h >> 32));
+}
+
+// Default hash functor suitable for integral types and enumerations.
+template <typename T> struct KHash
+{
+	ULONG operator()(const T& val) const
+	{
+		return HashMix(static_cast<ULONGLONG>(val));
+	}
+};
+
+template <typename T> struct KHash<T*>
+{
+	ULONG operator()(T* val) const
+	{
+		return HashMix(static_cast<ULONGLONG>(reinterpret_cast<ULONG_PTR>(val)));
+	}
+};
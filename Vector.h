@@ -2,6 +2,7 @@
 
 #include "CommonDefinitions.h"
 #include "Allocator.h"
+#include "Utility.h"
 
 #pragma warning(disable: 4100)
 
@@ -178,6 +179,26 @@ public:
 		Cleanup();
 	}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	// Steals the array rather than copying items.
+	KVector(KVector&& other)
+	{
+		Setup();
+		TakeOver(other);
+	}
+
+	KVector& operator = (KVector&& other)
+	{
+		if (this != &other)
+		{
+			Cleanup();
+			TakeOver(other);
+		}
+
+		return *this;
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
 	Iter_t Begin()
 	{
 		Iter_t iterator(m_data, m_size);
@@ -300,9 +321,27 @@ public:
 		Size_t newSize = m_size + 1;
 		Resize(newSize);
 
+		// Growth failed, so there is no room for the entry.
+		if (m_size != newSize)
+			return;
+
 		m_data[pos] = val;
 	}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	void PushBack(Val_t&& val)
+	{
+		Size_t pos = m_size;
+		Size_t newSize = m_size + 1;
+		Resize(newSize);
+
+		if (m_size != newSize)
+			return;
+
+		m_data[pos] = ::Move(val);
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
 	void PopBack()
 	{
 		ASSERT(!IsEmpty());
@@ -326,6 +365,20 @@ public:
 		return Iter_t(m_data, m_size, posIndex);
 	}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	Iter_t Insert(Iter_t pos, Val_t&& val)
+	{
+		Size_t newSize = m_size + 1;
+		Resize(newSize);
+
+		Size_t posIndex = pos.m_index;
+		MoveRight(posIndex);
+		m_data[posIndex] = ::Move(val);
+
+		return Iter_t(m_data, m_size, posIndex);
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
 	Iter_t Insert(Iter_t pos, Iter_t first, Iter_t last)
 	{
 		Size_t count = Distance(first, last);
@@ -432,17 +485,20 @@ protected:
 	void Grow(Size_t incrementSize, bool increaseCapacity, Val_t val = Val_t())
 	{
 		Size_t newSize = incrementSize;
+		Size_t newCapacity = m_capacity;
 		if (increaseCapacity && (incrementSize >= m_size))
 		{
 			// Doubling the capacity.
-			m_capacity = (newSize << 1);
+			newCapacity = (newSize << 1);
 		}
-		Ptr_t newData = m_allocator.Allocate(m_capacity * sizeof(T));
+		Ptr_t newData = m_allocator.Allocate(newCapacity * sizeof(T));
 		ASSERT(newData);
 
+		// Capacity is updated only along with the array, so the vector stays consistent on failure.
 		if (!newData)
 			return;
 
+		m_capacity = newCapacity;
 		if (increaseCapacity)
 			Move(newData);
 		Append(newData, incrementSize, val);
@@ -453,13 +509,13 @@ protected:
 
 	void Grow(Size_t newCapacity)
 	{
-		m_capacity = newCapacity;
-		Ptr_t newData = m_allocator.Allocate(m_capacity * sizeof(T));
+		Ptr_t newData = m_allocator.Allocate(newCapacity * sizeof(T));
 		ASSERT(newData);
 
 		if (!newData)
 			return;
 
+		m_capacity = newCapacity;
 		Move(newData);
 		m_data = newData;
 	}
@@ -467,30 +523,40 @@ protected:
 	void Shrink(Size_t newSize, Val_t val = Val_t())
 	{
 		bool invalidate = true;
+		Size_t newCapacity = m_capacity;
 
 		if (newSize == 0)
 		{
-			m_capacity = 1;
+			newCapacity = 1;
 		}
 		else if ((newSize < m_size) && (newSize % 2))
 		{
 			Size_t capacity = m_capacity >> 1;
 			if (capacity > newSize)
-				m_capacity = capacity;
+				newCapacity = capacity;
 			else
 				invalidate = false;
 		}
 
+		// Entries beyond the new size are gone whatever array keeps the rest.
+		for (Size_t i = newSize; i < m_size; i++)
+			m_allocator.Destroy(&m_data[i]);
+
 		// Data array of smaller capacity needed only when the half of previous capacity exceeds new size.
 		// Otherwise we've got enough space to retain data in the same array.
 		if (invalidate)
 		{
-			Ptr_t newData = m_allocator.Allocate(m_capacity * sizeof(T));
+			Ptr_t newData = m_allocator.Allocate(newCapacity * sizeof(T));
 			ASSERT(newData);
 
-			Trim(newData, newSize);
+			// Keep the current array if a smaller one is not available.
+			if (newData)
+			{
+				Trim(newData, newSize);
 
-			m_data = newData;
+				m_data = newData;
+				m_capacity = newCapacity;
+			}
 		}
 
 
@@ -506,7 +572,7 @@ protected:
 
 		for (Size_t i = pos; i < len; i++)
 		{
-			dst[i] = src[i];
+			dst[i] = ::Move(src[i]);
 			m_allocator.Destroy(&src[i]);
 		}
 
@@ -525,7 +591,7 @@ protected:
 		Size_t newIndex = m_size - 1;
 		index = newIndex - 1;
 		for (; index >= pos; index--, newIndex--)
-			m_data[newIndex] = m_data[index];
+			m_data[newIndex] = ::Move(m_data[index]);
 
 		// Delete entry at the position to the right of which data has been moved.
 		m_allocator.Destroy(&m_data[pos]);
@@ -542,7 +608,7 @@ protected:
 		Size_t newIndex = m_size - 1;
 		Size_t index = newIndex - count;
 		for (; index >= pos; index--, newIndex--)
-			m_data[newIndex] = m_data[index];
+			m_data[newIndex] = ::Move(m_data[index]);
 
 		// Delete entries in the initial range.
 		for (index = lowerBound; index <= upperBound; index++)
@@ -559,7 +625,7 @@ protected:
 		// Shifting each subsequent entry left to a position in the array. 
 		Size_t newIndex = index + 1;
 		for (; newIndex < m_size; index++, newIndex++)
-			m_data[index] = m_data[newIndex];
+			m_data[index] = ::Move(m_data[newIndex]);
 	}
 
 	void MoveLeftRange(Size_t lowerBound, Size_t upperBound)
@@ -572,7 +638,7 @@ protected:
 		Size_t index = lowerBound;
 		Size_t newIndex = upperBound;
 		for (; newIndex < m_size; index++, newIndex++)
-			m_data[index] = m_data[newIndex];
+			m_data[index] = ::Move(m_data[newIndex]);
 	}
 
 	void Trim(Ptr_t newData, Size_t newSize)
@@ -605,6 +671,17 @@ protected:
 		return static_cast<Dif_t>(last.m_index - first.m_index);
 	}
 
+#if defined(CXX11_MOVE_SEMANTICS)
+	void TakeOver(KVector& other)
+	{
+		m_data = other.m_data;
+		m_size = other.m_size;
+		m_capacity = other.m_capacity;
+
+		other.Setup();
+	}
+#endif // CXX11_MOVE_SEMANTICS
+
 private:
 	Alloc m_allocator;
 	T* m_data;
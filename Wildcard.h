@@ -267,12 +267,12 @@ Text wildcard_fast(
 	return sp;
 }
 
-bool WildcardFast(const char* pattern, const char* text)
+inline bool WildcardFast(const char* pattern, const char* text)
 {
 	return (wildcard_fast(pattern, (const char*)0, text, (const char*)0) != (const char*)0);
 }
 
-bool WildcardFast(const wchar_t* pattern, const wchar_t * text)
+inline bool WildcardFast(const wchar_t* pattern, const wchar_t * text)
 {
 	return (wildcard_fast(pattern, (const wchar_t*)0, text, (const wchar_t*)0) != (const wchar_t*)0);
 }
\ No newline at end of file